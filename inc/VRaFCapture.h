@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+
+namespace VRaF {
+
+	// Time is in seconds of the clock passed to Sequencer::update
+	struct Sample {
+		double time;
+		float value;
+	};
+
+	/**
+	 * Single-producer single-consumer lock-free ring of samples.
+	 * The producer is the sampler thread or a host thread (physics, input),
+	 * the consumer is the UI thread calling Sequencer::update.
+	 */
+	class SampleRing
+	{
+	public:
+		// Capacity is rounded up to a power of two
+		explicit SampleRing(size_t capacity = 4096);
+		// Returns false and drops the sample when the ring is full
+		bool push(const Sample& sample);
+		bool pop(Sample& sample);
+	private:
+		std::vector<Sample> buffer;
+		size_t mask;
+		alignas(64) std::atomic<size_t> head{ 0 };  // Written by the producer
+		alignas(64) std::atomic<size_t> tail{ 0 };  // Written by the consumer
+	};
+
+	// Samples values at a fixed rate on its own thread and pushes them into
+	// their rings. It never reads the targets, which other threads write: the
+	// writer of each value also stores it into the atomic returned by add()
+	class Sampler
+	{
+	public:
+		Sampler(int rate);
+		~Sampler();
+		std::atomic<float>* add(float value, std::shared_ptr<SampleRing> ring);
+		// Maps the sampler clock to the host clock
+		void sync(double host_time);
+	private:
+		void run();
+		static double now();
+
+		int rate;
+		std::atomic<bool> running{ true };
+		std::atomic<double> offset{ 0 };
+		std::mutex mutex;
+		struct Source {
+			std::atomic<float> value;
+			std::shared_ptr<SampleRing> ring;
+		};
+		std::vector<std::unique_ptr<Source>> sources;
+		std::thread thread;
+	};
+}
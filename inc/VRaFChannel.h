@@ -0,0 +1,107 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include "glm.hpp"
+#include "gtc/quaternion.hpp"
+#include "../imgui/imgui.h"
+
+namespace VRaF {
+	/**
+	 * Compile-time description of a tracked type, see Sequencer::track<T>:
+	 *   components        number of float components, each recorded as an event
+	 *   component(v, i)   pointer to component i of v
+	 *   is_separable      whether the components are independent curves
+	 * Types that aren't separable also give the rules applied to all of their
+	 * components at once, on arrays of 'components' floats:
+	 *   blend(a, b, w, out)     between two values, for keys and crossfades
+	 *   project(v)              back onto valid values, after evaluating the
+	 *                           components one by one, e.g. by a spline
+	 *   encode(v, previous)     into the domain the filters work in; previous
+	 *   decode(v)               is the encoded key before, or null
+	 * Specialize it to track other types
+	 */
+	template <typename T> struct ChannelTraits;
+
+	const int MAX_COMPONENTS = 16;
+
+	template <int N> struct SeparableTraits {
+		static constexpr int components = N;
+		static constexpr bool is_separable = true;
+	};
+
+	template <> struct ChannelTraits<float> : SeparableTraits<1> {
+		static float* component(float* v, int) { return v; }
+	};
+
+	template <> struct ChannelTraits<glm::vec2> : SeparableTraits<2> {
+		static float* component(glm::vec2* v, int i) { return &(*v)[i]; }
+	};
+
+	template <> struct ChannelTraits<glm::vec3> : SeparableTraits<3> {
+		static float* component(glm::vec3* v, int i) { return &(*v)[i]; }
+	};
+
+	template <> struct ChannelTraits<glm::vec4> : SeparableTraits<4> {
+		static float* component(glm::vec4* v, int i) { return &(*v)[i]; }
+	};
+
+	// Unit quaternion, slerped along the shorter arc. Filters see the keys on
+	// one hemisphere, as q and -q are the same rotation, then renormalized
+	template <> struct ChannelTraits<glm::quat> {
+		static constexpr int components = 4;
+		static constexpr bool is_separable = false;
+		static float* component(glm::quat* q, int i) { return &(*q)[i]; }
+		static glm::quat load(const float* v) {
+			glm::quat q;
+			for (int i = 0; i < 4; i++) q[i] = v[i];
+			return q;
+		}
+		static void store(const glm::quat& q, float* v) {
+			for (int i = 0; i < 4; i++) v[i] = q[i];
+		}
+		static void blend(const float* a, const float* b, float w, float* out) {
+			store(glm::slerp(load(a), load(b), w), out);
+		}
+		static void project(float* v) {
+			glm::quat q = load(v);
+			float length = glm::length(q);
+			if (length > 0) store(q / length, v);
+		}
+		static void encode(float* v, const float* previous) {
+			if (!previous || glm::dot(load(v), load(previous)) >= 0) return;
+			for (int i = 0; i < 4; i++) v[i] = -v[i];
+		}
+		static void decode(float* v) { project(v); }
+	};
+
+	// sRGB color with alpha, blended and filtered in linear light so that a
+	// fade between two colors doesn't dip through darker ones
+	template <> struct ChannelTraits<ImColor> {
+		static constexpr int components = 4;
+		static constexpr bool is_separable = false;
+		static float* component(ImColor* c, int i) {
+			ImVec4& v = c->Value;
+			return i == 0 ? &v.x : i == 1 ? &v.y : i == 2 ? &v.z : &v.w;
+		}
+		static float linear(float s) {
+			return s <= 0.04045f ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+		}
+		static float srgb(float l) {
+			return l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1 / 2.4f) - 0.055f;
+		}
+		static void blend(const float* a, const float* b, float w, float* out) {
+			for (int i = 0; i < 3; i++) out[i] = srgb(std::max(linear(a[i]) + (linear(b[i]) - linear(a[i])) * w, 0.0f));
+			out[3] = a[3] + (b[3] - a[3]) * w;
+		}
+		static void project(float* v) {
+			for (int i = 0; i < 4; i++) v[i] = std::clamp(v[i], 0.0f, 1.0f);
+		}
+		static void encode(float* v, const float*) {
+			for (int i = 0; i < 3; i++) v[i] = linear(v[i]);
+		}
+		static void decode(float* v) {
+			for (int i = 0; i < 3; i++) v[i] = srgb(std::max(v[i], 0.0f));
+			project(v);
+		}
+	};
+}
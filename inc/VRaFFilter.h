@@ -0,0 +1,113 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace VRaF {
+
+	enum FilterType {
+		FILTER_BUTTERWORTH,     // Zero-phase low-pass of designable order and cutoff
+		FILTER_SAVITZKY_GOLAY,  // Local polynomial fit, keeps peaks better
+		FILTER_ONE_EURO         // Adaptive: smooths slow motion more than fast one
+	};
+
+	struct FilterSettings {
+		FilterType type = FILTER_BUTTERWORTH;
+		// Butterworth: cutoff is a fraction of the Nyquist frequency, 0..1;
+		// lower is smoother. The defaults match the original "F" button
+		float cutoff = 0.4f;
+		int order = 1;
+		// Savitzky-Golay: window is 2 * half_window + 1 samples
+		int half_window = 4;
+		int degree = 2;
+		// One-Euro: cutoffs in Hz at the given sample rate
+		float min_cutoff = 1.0f;
+		float beta = 0.0f;
+		float d_cutoff = 1.0f;
+		float rate = 30.0f;
+
+		bool operator==(const FilterSettings&) const = default;
+	};
+
+	// Direct form I section: y = b0 x + b1 x1 + b2 x2 - a1 y1 - a2 y2
+	struct Biquad {
+		float b0, b1, b2, a1, a2;
+	};
+
+	// Low-pass Butterworth as a cascade of second-order sections
+	// (plus a first-order one for odd orders), via the bilinear transform
+	std::vector<Biquad> butterworth(int order, float cutoff);
+
+	// Causal One-Euro filter, one sample at a time
+	struct OneEuro {
+		FilterSettings settings;
+		bool initialized = false;
+		float x_prev = 0;
+		float dx_prev = 0;
+		float operator()(float x);
+	};
+
+	constexpr int MAX_SECTIONS = 8;
+	constexpr int MAX_HALF_WINDOW = 50;
+
+	/**
+	 * Causal filter for samples arriving one at a time, e.g. while recording.
+	 * Butterworth runs the cascade forward only, Savitzky-Golay evaluates the
+	 * polynomial fit of the last window at the newest sample. Lower cutoffs or
+	 * wider windows remove more jitter at the cost of more latency.
+	 * Copying it copies the filter state.
+	 */
+	struct LiveFilter {
+		LiveFilter(const FilterSettings& settings = FilterSettings());
+		float operator()(float x);
+
+		FilterSettings settings;
+		bool initialized = false;
+		// Butterworth
+		int n_sections = 0;
+		Biquad sections[MAX_SECTIONS];
+		float state[MAX_SECTIONS][4];  // x1, x2, y1, y2
+		// Savitzky-Golay
+		int window = 0;
+		int newest = 0;
+		float weights[2 * MAX_HALF_WINDOW + 1];
+		float history[2 * MAX_HALF_WINDOW + 1];
+		// One-Euro
+		OneEuro one_euro;
+	};
+
+	/**
+	 * Filter kernels working on several equally long channels at once.
+	 * Channels are processed in groups of FILTER_LANES; within a group every
+	 * time step updates all the lanes in one loop, which the compiler turns
+	 * into vector instructions.
+	 */
+	constexpr int FILTER_LANES = 8;
+
+	// One pass of the cascade, forward or backward in time. The data is
+	// traversed in place; nothing is reversed
+	void biquads(float* const* channels, int count, size_t length,
+		const std::vector<Biquad>& sections, bool is_backwards);
+
+	// Zero-phase filtering with the chosen filter in a single call
+	void filter(float* const* channels, int count, size_t length, const FilterSettings& settings);
+
+	// Weights of the 4 control points around position s, 0..1, within a
+	// segment of a uniform cubic B-spline
+	inline void bsplineBasis(float s, float w[4]) {
+		float s2 = s * s, s3 = s2 * s;
+		w[0] = (1 - 3 * s + 3 * s2 - s3) / 6;
+		w[1] = (4 - 6 * s2 + 3 * s3) / 6;
+		w[2] = (1 + 3 * s + 3 * s2 - 3 * s3) / 6;
+		w[3] = s3 / 6;
+	}
+
+	/**
+	 * Least-squares fit of a uniform cubic B-spline with 'points' control points
+	 * (at least 4) spanning t = 0..1 to every channel; the keys are at 'times',
+	 * or uniform when null. Smoothing penalizes the second differences of the
+	 * control points: 0 is a plain fit, larger values give straighter curves.
+	 * The channels share a single banded factorization
+	 */
+	void fitBSpline(const float* const* channels, int count, size_t length, const float* times,
+		size_t points, float smoothing, float* const* out);
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace VRaF {
+	/**
+	 * Append-only journal, see Sequencer::autosave. After a short header, each
+	 * record is its payload size (uint32), its type (uint8), the payload and an
+	 * FNV-1a checksum (uint32) of the type and payload. A record cut short by a
+	 * crash fails the checksum, and replay stops there
+	 */
+	const char JOURNAL_MAGIC[8] = { 'V', 'R', 'a', 'F', 'J', 'r', 'n', 'l' };
+	const uint32_t JOURNAL_VERSION = 2;
+
+	enum JournalRecordType : uint8_t {
+		JOURNAL_SAMPLES = 1,  // Recorded frames, final ones only
+		JOURNAL_COMMIT,       // A recording spliced into the event keys
+		JOURNAL_MOVE,
+		JOURNAL_FILTER,
+		JOURNAL_CLEAR,
+		JOURNAL_INTERPOLATE,
+		JOURNAL_KEYS,         // All the keys of an event, e.g. after loading a take
+		JOURNAL_SPLICE        // A range of keys replaced, see Keyframes::splice (version 2)
+	};
+
+	struct JournalRecord {
+		JournalRecordType type;
+		std::vector<uint8_t> data;
+		JournalRecord(JournalRecordType type) : type(type) {}
+		template <typename T> JournalRecord& operator<<(const T& value) {
+			static_assert(std::is_trivially_copyable_v<T>);
+			const uint8_t* bytes = (const uint8_t*)&value;
+			data.insert(data.end(), bytes, bytes + sizeof(T));
+			return *this;
+		}
+		JournalRecord& operator<<(const std::string& text);
+		template <typename T> JournalRecord& write(const T* values, size_t count) {
+			const uint8_t* bytes = (const uint8_t*)values;
+			data.insert(data.end(), bytes, bytes + count * sizeof(T));
+			return *this;
+		}
+	};
+
+	// Reads the fields of a record back; reading past its end clears is_valid
+	struct JournalReader {
+		const uint8_t* at;
+		const uint8_t* end;
+		bool is_valid = true;
+		template <typename T> T read() {
+			T value = {};
+			if ((size_t)(end - at) < sizeof(T)) is_valid = false;
+			else memcpy(&value, at, sizeof(T));
+			at += is_valid ? sizeof(T) : 0;
+			return value;
+		}
+		std::string readString();
+		// Appends count values
+		template <typename T> void read(std::vector<T>& values, size_t count) {
+			if ((size_t)(end - at) / sizeof(T) < count) is_valid = false;
+			if (!is_valid || count == 0) return;
+			size_t from = values.size();
+			values.resize(from + count);
+			memcpy(values.data() + from, at, count * sizeof(T));
+			at += count * sizeof(T);
+		}
+	};
+
+	// Records are appended from the UI thread and written in batches by a
+	// background thread, so the UI never waits on the disk
+	class Journal
+	{
+	public:
+		// Appends to the file, creating it if needed
+		Journal(const std::string& path);
+		~Journal();
+		bool isOpen() const { return file != nullptr; }
+		void append(const JournalRecord& record);
+		// Blocks until everything appended so far is written
+		void flush();
+		// Calls apply for every intact record; returns false if the file isn't a journal
+		static bool replay(const std::string& path, const std::function<void(JournalRecordType, JournalReader&)>& apply);
+	private:
+		FILE* file = nullptr;
+		std::thread writer;
+		std::mutex mutex;
+		std::condition_variable wake, written;
+		std::vector<uint8_t> pending;
+		uint64_t appended = 0, flushed = 0;  // Bytes
+		bool is_flushing = false;
+		bool is_stopping = false;
+		void run();
+	};
+}
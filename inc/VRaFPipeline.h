@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace VRaF {
+	class Sequencer;
+
+	// Values of all the channels at one frame, see Sequencer::channels()
+	struct FrameSnapshot {
+		int frame;
+		std::vector<float> values;
+	};
+
+	/**
+	 * Evaluates frames of a sequencer on worker threads ahead of the consumer.
+	 * Snapshots come out in frame order and are immutable, so they can be handed
+	 * to several render threads at once. The sequencer must not be edited while
+	 * the pipeline is alive. Channels without keys hold the values their targets
+	 * had when the pipeline was created, as the host may change them meanwhile.
+	 */
+	class FramePipeline
+	{
+	public:
+		class Iterator
+		{
+		public:
+			Iterator(FramePipeline* pipeline, std::shared_ptr<const FrameSnapshot> snapshot)
+				: pipeline(pipeline), snapshot(snapshot) {}
+			bool operator!=(const Iterator& other) const { return snapshot != other.snapshot; }
+			Iterator& operator++() { snapshot = pipeline->next(); return *this; }
+			std::shared_ptr<const FrameSnapshot> operator*() { return snapshot; }
+		private:
+			FramePipeline* pipeline;
+			std::shared_ptr<const FrameSnapshot> snapshot;
+		};
+
+		// workers = 0 uses all hardware threads; lookahead = 0 uses twice the workers
+		FramePipeline(const Sequencer* sequencer, int from, int to, int workers = 0, int lookahead = 0);
+		~FramePipeline();
+		FramePipeline(const FramePipeline&) = delete;
+		FramePipeline& operator=(const FramePipeline&) = delete;
+
+		// Next frame in order, or nullptr past the last one
+		std::shared_ptr<const FrameSnapshot> next();
+		Iterator begin() { return Iterator(this, next()); }
+		Iterator end() { return Iterator(this, nullptr); }
+
+	private:
+		void work();
+
+		const Sequencer* sequencer;
+		std::vector<float> held;  // Values of the channels without keys
+		int from, to;
+		int scheduled;  // Next frame to hand out to a worker
+		int consumed;   // Next frame to hand out to the consumer
+		bool stopping = false;
+		std::vector<std::shared_ptr<const FrameSnapshot>> slots;
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable cv;
+	};
+}
@@ -1,33 +1,307 @@
 #pragma once
+#include <algorithm>
+#include <climits>
 #include <vector>
+#include <memory>
 #include <string>
+#include <functional>
 #include "glm.hpp"
 #include "../imgui/imgui.h"
+#include "VRaFPipeline.h"
+#include "VRaFCapture.h"
+#include "VRaFFilter.h"
+#include "VRaFJournal.h"
+#include "VRaFChannel.h"
+#include "VRaFSnapshot.h"
+#include "VRaFShared.h"
 
 // Vector Recording and Filtering namespace
 namespace VRaF {
 	class Sequencer;
 
+	enum Interpolation {
+		INTERPOLATION_STEP,         // Hold the last key
+		INTERPOLATION_LINEAR,
+		INTERPOLATION_HERMITE,      // Monotone cubic, never overshoots the keys
+		INTERPOLATION_CATMULL_ROM,
+		INTERPOLATION_BSPLINE       // Keys are control points of a uniform cubic B-spline, see Sequencer::fit
+	};
+
+	/**
+	 * Columnar keyframe storage. Time is a float from 0 to 1, in order to ease
+	 * scaling. Uniformly sampled keys (e.g. a recording) don't store times at
+	 * all: key i is at i / (n - 1). The values and the times are split into
+	 * chunks of up to CHUNK keys, shared copy-on-write with the undo history,
+	 * and the time chunks also between the channels of a track recorded
+	 * together. An edit copies only the chunks it changes; a splice rewrites
+	 * only the chunks it touches, which may leave them shorter than CHUNK.
+	 * Both may also be read in place from a mapped take file
+	 */
+	struct Keyframes {
+		static constexpr size_t CHUNK = 4096;
+
+		size_t size() const { return starts.empty() ? 0 : starts.back(); }
+		bool empty() const { return size() == 0; }
+		bool uniform() const { return time_chunks.empty(); }
+		float time(size_t i) const {
+			if (!uniform()) {
+				size_t c = locate(i);
+				return time_chunks[c].get()[i - starts[c]];
+			}
+			size_t n = size();
+			return n > 1 ? (float)i / (int)(n - 1) : 0.0f;
+		}
+		float value(size_t i) const {
+			size_t c = locate(i);
+			return chunks[c].get()[i - starts[c]];
+		}
+		// Chunk c holds chunkSize(c) keys from key chunkStart(c) on
+		size_t chunkCount() const { return chunks.size(); }
+		size_t chunkStart(size_t c) const { return starts[c]; }
+		size_t chunkSize(size_t c) const { return starts[c + 1] - starts[c]; }
+		const float* chunk(size_t c) const { return chunks[c].get(); }
+		// Null for uniform keys
+		const float* timeChunk(size_t c) const { return uniform() ? nullptr : time_chunks[c].get(); }
+		// Chunk holding key i
+		size_t locate(size_t i) const {
+			if (is_regular) return i / CHUNK;
+			return std::upper_bound(starts.begin(), starts.end(), i) - starts.begin() - 1;
+		}
+		// Values of chunk c for modification. A chunk that is shared, e.g. with
+		// the undo history, or read in place is copied first
+		float* edit(size_t c);
+		// Overwrites the values of keys i to i + n - 1
+		void write(size_t i, const float* values, size_t n);
+		// Keys added at the end are zero. Uniform keys only
+		void resize(size_t n);
+		// Replaces keys from to to - 1 with n keys at the given times, keeping the
+		// chunks around them. Uniform keys stay uniform and take no times
+		void splice(size_t from, size_t to, const float* values, const float* key_times, size_t n);
+		// Contiguous copy of the values, e.g. for filters, and of the times
+		std::vector<float> copy() const;
+		std::vector<float> copyTimes() const;
+		void assign(std::vector<float> keys, std::shared_ptr<const float> key_times = nullptr);
+		// New values for the same keys: the times and the chunks stay
+		void replace(const std::vector<float>& keys);
+		// Read n values in place; the pointer keeps their memory alive
+		void view(std::shared_ptr<const float> keys, size_t n, std::shared_ptr<const float> key_times = nullptr);
+		bool isView() const;
+		void clear() { chunks.clear(); time_chunks.clear(); starts.clear(); is_regular = true; }
+		// Whether the keys are at the same times, with the same chunks
+		bool sameTimes(const Keyframes& other) const;
+		// Shares the time chunks of other, if its keys are at the same times
+		// and chunked alike. Only the chunks not shared yet are compared
+		bool shareTimes(const Keyframes& other);
+		// First key with time >= t, and with time > t
+		size_t lower_bound(float t) const;
+		size_t upper_bound(float t) const;
+		// Time column owning its storage, to be shared between channels
+		static std::shared_ptr<const float> column(std::vector<float> times);
+		// Time column of keys at the given frames, the first one at 0 and the last at 1
+		static std::shared_ptr<const float> frameTimes(const std::vector<int>& frames);
+	private:
+		friend class Sequencer;  // The undo history swaps chunks
+		friend struct ImportedKeys;
+		std::vector<std::shared_ptr<const float>> chunks;
+		std::vector<std::shared_ptr<const float>> time_chunks;  // Empty for uniform keys
+		std::vector<size_t> starts;  // First key of each chunk, then the key count
+		bool is_regular = true;      // Every chunk but the last holds CHUNK keys
+		void chunked(size_t n);      // Regular chunk starts for n keys
+		void updated();
+		size_t search(float t, bool is_upper) const;
+	};
+
+	// Min/max of the keyframe values over blocks of 2^level keys, so that
+	// drawing a long curve doesn't visit every key
+	struct CurvePyramid {
+		// Level l element i covers level l - 1 elements 2i and 2i + 1;
+		// level 0 are the values themselves and aren't stored
+		std::vector<std::vector<float>> mins, maxs;
+		bool empty() const { return mins.empty(); }
+		void build(const Keyframes& keys);
+		void clear() { mins.clear(); maxs.clear(); }
+		// Min and max of the values of keys [from..to)
+		void range(const Keyframes& keys, size_t from, size_t to, float& lo, float& hi) const;
+	};
+
+	struct Event;
+
+	// Entry points of ChannelTraits<T> for the tracks of types that aren't
+	// separable; their components are evaluated, blended and filtered together.
+	// Tracks of any type share one list, so the type is resolved once per track
+	// by Sequencer::track<T>. Each entry then does all of its work with the
+	// traits inlined, e.g. a whole batch of times, rather than a call per key
+	struct ChannelKernel {
+		int components;
+		// Values of the components at frame; 'first' is the first event of the
+		// track. Null cursors use the playheads of the events
+		void (*evaluate)(const Event* first, double frame, size_t* cursors, float* out);
+		// Values at count times, each clamped to the event; out[c * count + i]
+		// is component c at times[i]
+		void (*evaluateTimes)(const Event* first, const double* times, int count, float* out);
+		void (*blend)(const float* a, const float* b, float w, float* out);
+		// Converts count keys in place, given a column per component
+		void (*encode)(float* const* components, size_t count);
+		void (*decode)(float* const* components, size_t count);
+	};
+
 	struct Event {
 		mutable int time;  // Start time, to be precise
 		mutable int duration;
-		// pair<float, float> is Time, Value
-		// In keyframes, time is a float from 0 to 1; in order to ease scaling
-		std::vector<std::pair<float, float>> keyframes;
+		Keyframes keyframes;
 		void update(int frame);
 		void filter(bool is_backwards);
 		void filter();
+		void filter(const FilterSettings& settings);
 		void clear();
+		// Punch-in: replaces the keys from the first to the last recorded frame
+		// and keeps the others, extending the event if the recording runs past
+		// it. values[i] is at frame start + i, or at frames[i] if there are
+		// frames. The first and last crossfade frames blend into the old curve
+		void splice(int start, std::vector<float> values, const std::vector<int>& frames, int crossfade = 0);
 		float* target = 0;
+		// Index of the first key past the last lookup. Playback moves it by
+		// a key or so per frame, so most lookups don't need a search at all
+		mutable size_t playhead = 0;
+		int channel = 0;  // Index in the output block, see Sequencer::output()
+		size_t seek(float t) const;
+		size_t seek(float t, size_t& cursor) const;
+		// Frame may be fractional; sub-frame values depend on interpolation
+		float value(double frame) const;
+		float value(double frame, size_t& cursor) const;
+		Interpolation interpolation = INTERPOLATION_STEP;
+
+		// Dense per-frame values starting at bakedFrom; empty when not baked
+		std::vector<float> baked;
+		int bakedFrom = 0;
+		void bake(int from, int to);
+		bool isBaked(int from, int to) const;
+		// Drop the bake after the event was moved, cropped or resampled
+		void invalidate();
+		// Drop everything derived from the keys after their values changed
+		void edited();
+		CurvePyramid pyramid;
+
+		// Samples captured off the UI thread, see Sequencer::capture
+		std::shared_ptr<SampleRing> ring;
+		std::atomic<float>* sampled = nullptr;  // Owned by the sampler
+
+		// Set on the events of a track whose components aren't independent
+		const ChannelKernel* kernel = nullptr;
+		int component = 0;
+		// Keys i and j around the frame, u from 0 at i to 1 at j; j is i at the ends
+		void segment(double frame, size_t& cursor, size_t& i, size_t& j, float& u) const;
+	};
+
+	// Components are blended with the type's rule while interpolating
+	// linearly. Other modes evaluate them one by one and project the result
+	template <typename T> void evaluateChannels(const Event* first, double frame, size_t* cursors, float* out)
+	{
+		using Traits = ChannelTraits<T>;
+		constexpr int n = Traits::components;
+		bool is_aligned = true;
+		for (int c = 1; c < n; c++) {
+			const Event& e = first[c];
+			is_aligned &= e.time == first->time && e.duration == first->duration
+				&& e.keyframes.sameTimes(first->keyframes);
+		}
+		if (first->interpolation == INTERPOLATION_LINEAR && is_aligned && !first->keyframes.empty()) {
+			size_t i, j;
+			float u, a[n], b[n];
+			first->segment(frame, cursors ? cursors[0] : first->playhead, i, j, u);
+			for (int c = 0; c < n; c++) {
+				a[c] = first[c].keyframes.value(i);
+				b[c] = first[c].keyframes.value(j);
+			}
+			Traits::blend(a, b, u, out);
+			return;
+		}
+		for (int c = 0; c < n; c++) out[c] = first[c].value(frame, cursors ? cursors[c] : first[c].playhead);
+		Traits::project(out);
+	}
+
+	template <typename T> void evaluateChannels(const Event* first, const double* times, int count, float* out)
+	{
+		constexpr int n = ChannelTraits<T>::components;
+		size_t cursors[n] = {};
+		float values[n];
+		double from = first->time, to = first->time + first->duration;
+		for (int i = 0; i < count; i++) {
+			evaluateChannels<T>(first, std::clamp(times[i], from, to), cursors, values);
+			for (int c = 0; c < n; c++) out[c * count + i] = values[c];
+		}
+	}
+
+	// Each key is encoded after the one before, e.g. to keep quaternions on one hemisphere
+	template <typename T> void encodeChannels(float* const* components, size_t count)
+	{
+		constexpr int n = ChannelTraits<T>::components;
+		float key[n], previous[n];
+		for (size_t k = 0; k < count; k++) {
+			for (int c = 0; c < n; c++) key[c] = components[c][k];
+			ChannelTraits<T>::encode(key, k > 0 ? previous : nullptr);
+			for (int c = 0; c < n; c++) components[c][k] = previous[c] = key[c];
+		}
+	}
+
+	template <typename T> void decodeChannels(float* const* components, size_t count)
+	{
+		constexpr int n = ChannelTraits<T>::components;
+		float key[n];
+		for (size_t k = 0; k < count; k++) {
+			for (int c = 0; c < n; c++) key[c] = components[c][k];
+			ChannelTraits<T>::decode(key);
+			for (int c = 0; c < n; c++) components[c][k] = key[c];
+		}
+	}
+
+	template <typename T> inline constexpr ChannelKernel channelKernel = {
+		ChannelTraits<T>::components,
+		&evaluateChannels<T>,
+		&evaluateChannels<T>,
+		&ChannelTraits<T>::blend,
+		&encodeChannels<T>,
+		&decodeChannels<T>
 	};
 
 	struct Recording {
 		float* target;
-		// As contrary to Event keyframes, this array holds
-		// frame index as the key, thus the key is of type int
-		// pair<int, float> is Frame, Value
-		std::vector<std::pair<int, float>> keyframes;
+		// As contrary to Event keyframes, recorded frames are contiguous,
+		// so the frame is implicit: values[i] was captured at frame start + i.
+		// Only frames that can't change any more are stored, see 'last'
+		int start = 0;
+		std::vector<float> values;
 		void update(int frame);
+		// When set, samples come from the ring instead of update()
+		std::shared_ptr<SampleRing> ring;
+		void add(int frame, float value);
+		// Stores the last frame too; called when the recording stops
+		void finish();
+
+		// The newest frame; a later sample of the same frame replaces it
+		bool is_started = false;
+		int last_frame = 0;
+		float last = 0;
+
+		// Change-driven recording, see Track::deadband. The stored frames are
+		// then sparse and listed in 'frames'
+		float deadband = 0;
+		int max_gap = 0;
+		bool is_extrapolated = false;  // Predict linearly rather than hold the value
+		std::vector<int> frames;
+		int settled_frame = 0;  // The frame before 'last', stored or not
+		float settled = 0;
+		void settle(int frame, float value);
+
+		// Optional causal filter applied as the samples arrive. It runs once
+		// per frame; 'before_last' is its state before the last frame, so a
+		// later sample of the same frame can replace it
+		bool is_filtered = false;
+		LiveFilter filter;
+		LiveFilter before_last;
+		float raw_last = 0;
+
+		size_t journaled = 0;  // Values already in the autosave journal
 	};
 
 	struct Track {
@@ -36,6 +310,111 @@ namespace VRaF {
 		std::vector<Recording> recordings;
 		std::string label;
 		bool is_expanded = true;
+		const ChannelKernel* kernel = nullptr;  // Null for separable types
+		// Used by the "F" button; right click on it to edit
+		FilterSettings filter;
+		// Filter applied while recording
+		bool live_filter = false;
+		FilterSettings live = { .type = FILTER_ONE_EURO, .min_cutoff = 2.0f, .beta = 0.1f };
+		// Recordings keep only the keys needed to stay within this error; 0 keeps every frame
+		float tolerance = 0;
+		// Change-driven recording: a frame is stored only when it strays from the
+		// prediction of the stored ones by more than deadband (0 stores them all),
+		// or when max_gap frames have passed without one
+		float deadband = 0;
+		int max_gap = 30;
+		float smoothing = 1;  // Used by the "Fit spline" button
+		// Frames over which a punch-in recording blends into the existing keys
+		int crossfade = 0;
+	};
+
+	// Event fields kept by the undo history, besides the chunks of its keys
+	struct EventState {
+		int time = 0;
+		int duration = 0;
+		Interpolation interpolation = INTERPOLATION_STEP;
+		// Chunk layout and time chunks of the keys
+		std::vector<size_t> starts;
+		std::vector<std::shared_ptr<const float>> times;
+		bool operator==(const EventState&) const = default;
+	};
+
+	// An event as changed by one step of the undo history
+	struct EventChange {
+		size_t track, event;
+		EventState before, after;
+		// The step replaced before_chunks, from chunk 'first' on, with
+		// after_chunks; the chunks around them are the same on both sides
+		size_t first = 0;
+		std::vector<std::shared_ptr<const float>> before_chunks, after_chunks;
+	};
+
+	/**
+	 * Undo history. The events as of the last checkpoint share their chunks
+	 * with the live events, so an edit copies the chunks it changes, and the
+	 * step keeps only those. Steps hold no keys of the events they don't change
+	 */
+	struct History {
+		std::vector<std::vector<EventChange>> steps;
+		size_t done = 0;  // Steps before it can be undone, the others redone
+		size_t limit = 100;
+		// State at the last checkpoint, per track and event
+		std::vector<std::vector<EventState>> states;
+		std::vector<std::vector<Keyframes>> keys;
+		bool is_dirty = false;  // Events moved since, e.g. by a drag not released yet
+	};
+
+	// A complete frame of the output block
+	struct FrameOutput {
+		uint64_t version;     // Number of frames committed so far
+		double frame;         // Fractional for sub-frame evaluation
+		const float* values;  // One per channel, in channel order
+		int count;
+	};
+
+	// Keys of one component read by the importers, moved into chunks as the
+	// rows arrive, so only a chunk per column is pending. Frames out of order
+	// are all kept pending instead, and sorted once the file is read
+	struct ImportedKeys {
+		Event* event = nullptr;  // Null for columns that aren't tracked
+		Keyframes keys;  // Their times are frames until the file is read
+		int first = 0;
+		bool has_gaps = false;  // Some frame after the first has no key; uniform keys otherwise
+		bool is_sorted = true;
+		std::vector<int> frames;  // Pending keys
+		std::vector<float> values;
+		// A repeated frame keeps its last value. 'times' is the time chunk
+		// another column of the row added; it's shared if the frames match
+		void add(int frame, float value, std::shared_ptr<const float>& times);
+		// Moves the first n pending keys into a chunk
+		void flush(size_t n, std::shared_ptr<const float>& times);
+	};
+
+	/**
+	 * Interval index over the events of all tracks, so that a frame update
+	 * visits only the active events. Implicit augmented interval tree: the
+	 * entries are sorted by start, every node also keeps the largest end in
+	 * its subtree. Moving one event re-sorts it in place and refreshes the
+	 * maxima in O(n), without allocating
+	 */
+	class EventIndex
+	{
+	public:
+		bool dirty = true;
+		void rebuild(std::vector<Track>& tracks);
+		void update(Event* event);
+		// Events with time <= frame <= time + duration. Events without keys
+		// aren't listed, the host owns their values
+		void query(int frame, std::vector<Event*>& out) const;
+	private:
+		struct Entry {
+			int start, end;  // Half-open: end is one past the last frame
+			int max;
+			Event* event;
+		};
+		std::vector<Entry> entries;
+		int root_level = -1;
+		void prepare();
 	};
 
 	struct SeqState {
@@ -84,6 +463,7 @@ namespace VRaF {
 	{
 	public:
 		friend class SeqIterator;
+		friend class FramePipeline;  // Evaluates with held values, see evaluate()
 
 		Sequencer(int fps=30);
 		void toggle();
@@ -95,15 +475,139 @@ namespace VRaF {
 		// The target must be contained in an event first.
 		// If the event contains multiple targets, all of them will be recorded
 		void record(float* target);
-		void track(std::string label, float* value);
-		void track(std::string label, glm::vec2* value);
-		void track(std::string label, glm::vec3* value);
-		void track(std::string label, glm::vec4* value);
+		// Tracks a value of any type with ChannelTraits, see VRaFChannel.h: float,
+		// glm::vec2/3/4, glm::quat and ImColor. Each component is an event
+		template <typename T> void track(std::string label, T* value);
+
+		// Smooth a track, or every track, with its zero-phase filter settings
+		void filter(std::string label);
+		void filter(std::string label, const FilterSettings& settings);
+		void filter();
+
+		// Output block: the value of every channel, in channel order, committed
+		// once per played back frame (by update() while playing, iteration,
+		// scrubbing and evaluate(time)). Hosts can copy all the animated values
+		// at once, or get a callback when a frame is complete, instead of
+		// reading the tracked values one by one. Channels being recorded or
+		// without keys take the values of their targets
+		FrameOutput output() const;
+		void onFrame(std::function<void(const FrameOutput&)> callback);
+		// With targets off, playback writes only the output block
+		void writeTargets(bool enable = true);
+		// Publishes every committed frame of the output block to a new triple
+		// buffer, so that another thread reads whole frames without locks,
+		// unlike the tracked values. Take one buffer per reader thread; it is
+		// dropped once the reader releases it
+		std::shared_ptr<SnapshotBuffer> snapshots();
+		// Publishes every committed frame to named shared memory, with the track
+		// labels, for a renderer process reading it with SharedFrameReader. Call
+		// it once the tracks are set up; slots is how many frames a reader may
+		// fall behind. An empty name stops sharing
+		bool share(std::string name, int slots = 64);
+
+		// Drops the keys that the remaining ones reproduce within tolerance, in
+		// value units and for the event interpolation. Simplified keys are no
+		// longer uniform, so filter before simplifying
+		void simplify(std::string label, float tolerance);
+		void simplify(float tolerance);
+		// Replaces the keys of a track with a least-squares cubic B-spline, the
+		// components of a vector fitted jointly. Larger smoothing gives a smoother
+		// curve; with points = 0 there is a control point per 4 keys
+		void fit(std::string label, float smoothing, int points = 0);
+
+		// Capture mode records samples pushed into per-target rings instead of
+		// reading the targets once per UI frame, so a slow UI frame doesn't drop
+		// samples. With rate = 0 the host pushes into ring(target) from its own
+		// thread, using the same clock it passes to update(). With rate > 0 a
+		// sampler thread samples rate times per second the values the host
+		// stores into sampled(target); the other targets are still read once
+		// per update()
+		void capture(bool enable = true, int rate = 0);
+		std::shared_ptr<SampleRing> ring(float* target);
+		// The value the sampler samples for the target, or null without a
+		// sampler. The host stores each new value of the target into it, e.g.
+		// from its physics thread
+		std::atomic<float>* sampled(float* target);
+
+		// Bake mode keeps a per-frame value array for each event over the
+		// playback range, so updates are a plain array lookup
+		void bake(bool enable = true);
+
+		void interpolate(std::string label, Interpolation mode);
+		// Sets the tracked values at a fractional frame, e.g. for motion blur
+		// sub-frames. Doesn't change the current frame
+		void evaluate(double time);
+
+		// Number of scalar channels, one per event in track order
+		int channels() const;
+		// Fills out[channel * count + i] with every channel's value at times[i]
+		// (or frames[i]). Neither the tracked values nor the sequencer state are
+		// modified. Sorted times are the fastest; before and after an event its
+		// first and last values are held
+		void evaluate(const double* times, int count, float* out) const;
+		void evaluate(const int* frames, int count, float* out) const;
+		// First channel of the track, or -1 if there is no such track
+		int channel(std::string label) const;
+
+		// Offline rendering over the playback range with frames evaluated ahead
+		// on worker threads. Unlike begin()/end(), the tracked values are not
+		// touched; every frame comes as an immutable snapshot
+		FramePipeline frames(int workers = 0, int lookahead = 0) const;
+
+		// Take files keep the events of every track, see VRaFTake.h. Tracks are
+		// matched by label on load, as the targets belong to the application.
+		// Uncompressed columns are evaluated straight from the mapped file, so
+		// a take opens instantly and its pages are shared between processes
+		bool save(std::string path, bool compressed = false) const;
+		bool load(std::string path);
+
+		// Exchange with other tools: one row per frame of the playback range, one
+		// column per component, named after the track label, or e.g. "label.x"
+		// for vectors and "label.5" past 4 components. Files are streamed through
+		// a fixed-size buffer; importing replaces the events of the tracked
+		// columns found in the file. A JSON file also sets the fps, which is
+		// reported when it changes
+		bool exportCSV(std::string path) const;
+		bool exportJSON(std::string path) const;
+		bool importCSV(std::string path);
+		bool importJSON(std::string path);
+
+		// Appends recorded samples and edits to a journal file as they happen,
+		// so a crash loses at most the last moments. Call it once the tracks are
+		// set up: an existing journal is replayed into them first, then compacted
+		// to just the replayed keys. An empty path stops autosaving
+		bool autosave(std::string path);
+
+		// Undoes the last edit of the events: a recording, filter, simplify or
+		// fit, interpolation change, clear, move, load or import. Also Ctrl+Z,
+		// and Ctrl+Y or Ctrl+Shift+Z to redo
+		void undo();
+		void redo();
+		bool canUndo() const { return history.done > 0; }
+		bool canRedo() const { return history.done < history.steps.size(); }
 
 	private:
 		SeqState state;
 		std::vector<Track> tracks;
 		int fps;
+		bool baking = false;
+		bool capturing = false;
+		std::unique_ptr<Sampler> sampler;
+		std::vector<ImVec2> curve;  // Reused for drawing keyframe curves
+		std::vector<int> rows;      // First row of each track in the editor
+		EventIndex index;
+		std::vector<Event*> active;  // Reused for index queries
+		std::vector<size_t> recording_tracks;
+		// Channels without keys take held[channel] instead of their target when
+		// held isn't null, so that other threads don't read the host's values
+		void evaluate(const double* times, int count, float* out, const float* held) const;
+		// Channels whose value the host owns: no keys, or being recorded
+		std::vector<const Event*> host_channels;
+		const std::vector<Event*>& activeEvents(int frame);
+		void moved(Event& event);
+		// Call after recordings start or stop, or keys of events are added or removed
+		void updateRecordingTracks();
+		bool isRecorded(const float* target) const;
 
 		Dimentions dims;
 		void stop_recording();
@@ -113,7 +617,66 @@ namespace VRaF {
 		void drawIndicators();
 		void updateEvents();
 		void updateEvents(int frame);
+		void updateInterpolated(double time);
+		void filter(const std::vector<Event*>& events, const FilterSettings& settings);
+		// Only the keys between the from and to frames are candidates for removal
+		void simplify(const std::vector<Event*>& events, float tolerance, int from = INT_MIN, int to = INT_MAX);
+		void fit(const std::vector<Event*>& events, float smoothing, int points);
+		void drainRings();
+		void connectRings();
+		std::vector<std::string> columnNames() const;
+		Event* column(const std::string& name);
+		void imported(std::vector<ImportedKeys>& columns);
+		std::unique_ptr<Journal> journal;
+		JournalRecord journalRecord(JournalRecordType type, const Event& event) const;
+		Event* journaledEvent(JournalReader& in);
+		void journalKeys(const Event& event);
+		void journalFilter(const Event& event, const FilterSettings& settings);
+		// Keys from to to - 1 replaced by the n keys from 'from' on
+		void journalSplice(const Event& event, size_t from, size_t to, size_t n);
+		void journalSamples();
+		History history;
+		// Ends an edit: the events that changed since the last checkpoint make
+		// an undo step, or just the new checkpoint if is_step is false
+		void checkpoint(bool is_step = true);
+		void restore(const EventChange& change, bool is_undo);
+		void updateChannels(const Event* first, double frame);
+		void crossfade(Track& track);
+		std::vector<float> outputs;
+		std::vector<uint64_t> written;  // Version + 1 of the last write of each channel
+		uint64_t version = 0;
+		double output_frame = 0;
+		bool writing_targets = true;
+		std::function<void(const FrameOutput&)> frame_callback;
+		std::vector<std::shared_ptr<SnapshotBuffer>> publishers;
+		std::unique_ptr<SharedFramePublisher> shared;
+		void write(const Event& event, float value);
+		void commit(double frame);
 		ImFont* icons;
 		ImFont* labels;
 	};
+
+	template <typename T> void Sequencer::track(std::string label, T* value)
+	{
+		using Traits = ChannelTraits<T>;
+		static_assert(Traits::components <= MAX_COMPONENTS);
+		Track t;
+		t.label = label;
+		for (int c = 0; c < Traits::components; c++) {
+			t.events.push_back({ 0, 0, {}, Traits::component(value, c) });
+			t.events[c].channel = outputs.size();
+			outputs.push_back(*t.events[c].target);
+			written.push_back(0);
+		}
+		if constexpr (!Traits::is_separable) {
+			t.kernel = &channelKernel<T>;
+			for (int c = 0; c < Traits::components; c++) {
+				t.events[c].kernel = t.kernel;
+				t.events[c].component = c;
+			}
+		}
+		tracks.push_back(std::move(t));
+		index.dirty = true;
+		updateRecordingTracks();
+	}
 }
@@ -0,0 +1,121 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace VRaF {
+	/**
+	 * Shared memory frames, see Sequencer::share. Laid out as:
+	 *   SharedHeader
+	 *   SharedTrack[track_count]
+	 *   labels, referenced by the tracks
+	 *   slot_count slots of slot_size bytes, each a SharedSlot followed by
+	 *   channel_count floats, aligned to SHARED_ALIGNMENT
+	 * Frame v (counting from 1) goes to slot (v - 1) % slot_count. A slot is a
+	 * seqlock: its sequence is odd while the frame is written, 2 * v after.
+	 * This header and VRaFShared.cpp make the reader library, without ImGui
+	 */
+	const char SHARED_MAGIC[8] = { 'V', 'R', 'a', 'F', 'S', 'h', 'm', 0 };
+	const uint32_t SHARED_VERSION = 1;
+	const uint64_t SHARED_ALIGNMENT = 64;
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared frames need lock-free atomics");
+
+	struct SharedHeader {
+		char magic[8];  // Written last, once the rest of the header is
+		uint32_t version;
+		uint32_t header_size;
+		int32_t fps;
+		uint32_t channel_count;
+		uint32_t track_count;
+		uint32_t slot_count;
+		uint64_t labels_offset;
+		uint64_t labels_size;
+		uint64_t slots_offset;
+		uint64_t slot_size;
+		std::atomic<uint64_t> published;  // Latest complete frame, 0 before the first
+	};
+
+	struct SharedTrack {
+		uint32_t label_offset;  // Relative to the labels
+		uint32_t label_size;
+		uint32_t first_channel;
+		uint32_t components;
+	};
+
+	struct SharedSlot {
+		std::atomic<uint64_t> sequence;
+		double frame;  // Fractional for sub-frame evaluation
+	};
+
+	// Label and channels of a track, as written by the sequencer
+	struct SharedTrackInfo {
+		std::string label;
+		int first_channel;
+		int components;
+	};
+
+	// Named read-write or read-only shared memory mapping
+	class SharedMemory
+	{
+	public:
+		// Creates the named memory, replacing any left by a crashed writer
+		static std::unique_ptr<SharedMemory> create(const std::string& name, size_t size);
+		static std::unique_ptr<SharedMemory> attach(const std::string& name);
+		~SharedMemory();
+		uint8_t* data() const { return bytes; }
+		size_t size() const { return length; }
+	private:
+		SharedMemory() = default;
+		uint8_t* bytes = nullptr;
+		size_t length = 0;
+		std::string name;
+		bool is_owner = false;  // Removes the name when closed
+		void* handle = nullptr;
+	};
+
+	// Writer side, filled by the sequencer with each committed frame
+	class SharedFramePublisher
+	{
+	public:
+		static std::unique_ptr<SharedFramePublisher> create(const std::string& name, int fps,
+			const std::vector<SharedTrackInfo>& tracks, int slots);
+		// Channels past the ones in the header are left out
+		void publish(uint64_t version, double frame, const float* values, int count);
+	private:
+		std::unique_ptr<SharedMemory> memory;
+		SharedHeader* header = nullptr;
+	};
+
+	/**
+	 * Reader side, for the renderer process. Frames are read in place: values()
+	 * points into the ring, so check intact() once done with them, as a reader
+	 * that falls slot_count frames behind sees its slot reused. read() copies a
+	 * frame and checks it.
+	 */
+	class SharedFrameReader
+	{
+	public:
+		// Null if no sequencer shares frames under that name
+		static std::unique_ptr<SharedFrameReader> attach(const std::string& name);
+		int fps() const { return header->fps; }
+		int channels() const { return header->channel_count; }
+		const std::vector<SharedTrackInfo>& tracks() const { return track_infos; }
+		// First channel of the track, or -1 if there is no such track
+		int channel(const std::string& label) const;
+		// Latest complete frame, 0 before the first one
+		uint64_t latest() const { return header->published.load(std::memory_order_acquire); }
+		// Null if the frame isn't complete in the ring
+		const float* values(uint64_t version, double* frame = nullptr) const;
+		bool intact(uint64_t version) const;
+		// Copies channels() values; false if the frame isn't in the ring
+		bool read(uint64_t version, float* out, double* frame = nullptr) const;
+	private:
+		std::unique_ptr<SharedMemory> memory;
+		const SharedHeader* header = nullptr;
+		std::vector<SharedTrackInfo> track_infos;
+		const SharedSlot* slot(uint64_t version) const;
+	};
+}
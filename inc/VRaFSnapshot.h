@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+namespace VRaF {
+
+	// A whole frame of the output block, see Sequencer::output()
+	struct PublishedFrame {
+		uint64_t version = 0;  // 0 until the first frame is published
+		double frame = 0;
+		std::vector<float> values;
+	};
+
+	/**
+	 * Triple buffer of output block frames for one reader thread, e.g. a render
+	 * thread, while the UI thread plays back. The writer fills the back buffer
+	 * and swaps it with the middle one; the reader takes the middle one when it
+	 * holds a newer frame. Neither side waits, and a frame is never torn.
+	 */
+	class SnapshotBuffer
+	{
+	public:
+		// Writer side, called by the sequencer once per committed frame
+		void publish(uint64_t version, double frame, const float* values, int count);
+		// Reader side: the latest published frame. It stays valid and unchanged
+		// until the next read()
+		const PublishedFrame& read();
+	private:
+		static const uint8_t FRESH = 4;  // Set in middle when the writer swapped last
+		PublishedFrame slots[3];
+		uint8_t back = 0;                        // Owned by the writer
+		alignas(64) std::atomic<uint8_t> middle{ 1 };
+		alignas(64) uint8_t front = 2;           // Owned by the reader
+	};
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace VRaF {
+	/**
+	 * Take file, see Sequencer::save. Little endian, laid out as:
+	 *   TakeHeader
+	 *   TakeTrack[track_count], TakeEvent[event_count], TakeColumn[column_count]
+	 *   labels, referenced by the tracks
+	 *   column blocks, each aligned to TAKE_ALIGNMENT
+	 * A column is the values or the times of an event. Raw columns are read in
+	 * place from the mapped file, compressed ones are decoded when loading.
+	 * Readers accept older versions and skip header fields they don't know
+	 */
+	const char TAKE_MAGIC[8] = { 'V', 'R', 'a', 'F', 'T', 'a', 'k', 'e' };
+	const uint32_t TAKE_VERSION = 1;
+	const uint64_t TAKE_ALIGNMENT = 64;
+	const uint32_t TAKE_UNIFORM = 0xFFFFFFFF;  // Event times column of uniform keys
+
+	enum TakeCodec : uint32_t {
+		CODEC_RAW,
+		CODEC_XOR_RLE  // Each value XORed with the previous one, bytes split into planes, zero runs packed
+	};
+
+	struct TakeHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t header_size;
+		int32_t fps;
+		int32_t range[2];
+		uint32_t track_count;
+		uint32_t event_count;
+		uint32_t column_count;
+		uint64_t labels_offset;
+		uint64_t labels_size;
+	};
+
+	struct TakeTrack {
+		uint32_t label_offset;  // Relative to the labels
+		uint32_t label_size;
+		uint32_t first_event;
+		uint32_t event_count;
+		float color[4];
+	};
+
+	struct TakeEvent {
+		int32_t time;
+		int32_t duration;
+		uint32_t interpolation;
+		uint32_t values;  // Column indices
+		uint32_t times;
+	};
+
+	struct TakeColumn {
+		uint64_t offset;
+		uint64_t size;   // Bytes in the file
+		uint64_t count;  // Floats once decoded
+		uint32_t codec;
+		uint32_t reserved;
+	};
+
+	// Read-only file mapping; the pages are shared between the processes mapping the file
+	class MappedFile
+	{
+	public:
+		static std::shared_ptr<MappedFile> open(const std::string& path);
+		~MappedFile();
+		const uint8_t* data() const { return bytes; }
+		size_t size() const { return length; }
+	private:
+		MappedFile() = default;
+		const uint8_t* bytes = nullptr;
+		size_t length = 0;
+	};
+
+	void compress(const float* values, size_t count, std::vector<uint8_t>& out);
+	// False if the data doesn't decode to exactly count values
+	bool decompress(const uint8_t* data, size_t size, float* values, size_t count);
+}
@@ -0,0 +1,76 @@
+#include "VRaFCapture.h"
+#include <chrono>
+
+namespace VRaF {
+
+	SampleRing::SampleRing(size_t capacity)
+	{
+		size_t size = 1;
+		while (size < capacity) size <<= 1;
+		buffer.resize(size);
+		mask = size - 1;
+	}
+
+	bool SampleRing::push(const Sample& sample)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) > mask) return false;
+		buffer[h & mask] = sample;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool SampleRing::pop(Sample& sample)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire)) return false;
+		sample = buffer[t & mask];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	Sampler::Sampler(int rate) : rate(rate)
+	{
+		thread = std::thread(&Sampler::run, this);
+	}
+
+	Sampler::~Sampler()
+	{
+		running = false;
+		thread.join();
+	}
+
+	std::atomic<float>* Sampler::add(float value, std::shared_ptr<SampleRing> ring)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		sources.push_back(std::make_unique<Source>(value, ring));
+		return &sources.back()->value;
+	}
+
+	void Sampler::sync(double host_time)
+	{
+		offset = host_time - now();
+	}
+
+	double Sampler::now()
+	{
+		using namespace std::chrono;
+		return duration<double>(steady_clock::now().time_since_epoch()).count();
+	}
+
+	void Sampler::run()
+	{
+		using namespace std::chrono;
+		auto period = duration_cast<steady_clock::duration>(duration<double>(1.0 / rate));
+		auto next = steady_clock::now();
+		while (running) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				double time = now() + offset;
+				for (auto& s : sources) s->ring->push({ time, s->value.load(std::memory_order_relaxed) });
+			}
+			next += period;
+			std::this_thread::sleep_until(next);
+		}
+	}
+}
@@ -0,0 +1,556 @@
+#include "VRaFSequencer.h"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <tuple>
+
+namespace VRaF {
+
+	// Frames evaluated and written at a time by the exporters
+	constexpr int EXCHANGE_CHUNK = 1024;
+	constexpr const char* COMPONENTS = "xyzw";
+
+	// Column suffix of component i: x, y, z or w, or its index for tracks of
+	// more than 4 components
+	static std::string componentName(size_t i, size_t count)
+	{
+		return count <= 4 ? std::string(1, COMPONENTS[i]) : std::to_string(i);
+	}
+
+	// Buffered character reader for the importers, so memory stays bounded by
+	// the buffer whatever the file size
+	class ChunkReader
+	{
+	public:
+		ChunkReader(const std::string& path) : file(path, std::ios::binary), buffer(1 << 16) {}
+		bool isOpen() const { return file.is_open(); }
+		int peek() {
+			if (at == end && !fill()) return EOF;
+			return (unsigned char)buffer[at];
+		}
+		int get() {
+			int c = peek();
+			if (c != EOF) at++;
+			return c;
+		}
+		void skipSpaces() {
+			while (peek() == ' ' || peek() == '\t' || peek() == '\n' || peek() == '\r') at++;
+		}
+	private:
+		std::ifstream file;
+		std::vector<char> buffer;
+		size_t at = 0, end = 0;
+		bool fill() {
+			file.read(buffer.data(), buffer.size());
+			end = file.gcount();
+			at = 0;
+			return end > 0;
+		}
+	};
+
+	// Reads a number into a fixed buffer and converts it without allocating.
+	// Returns false if there is no number, e.g. for an empty CSV cell
+	static bool readNumber(ChunkReader& in, float& value)
+	{
+		char digits[64];
+		size_t n = 0;
+		for (int c = in.peek(); n < sizeof(digits) && (isalnum(c) || c == '.' || c == '-' || c == '+'); c = in.peek()) {
+			digits[n++] = (char)in.get();
+		}
+		const char* first = digits;
+		if (n > 0 && digits[0] == '+') first++;  // from_chars doesn't take a plus sign
+		auto [last, error] = std::from_chars(first, digits + n, value);
+		return n > 0 && error == std::errc() && last == digits + n;
+	}
+
+	static void writeNumber(std::ofstream& out, float value)
+	{
+		// Shortest representation that reads back to the same float
+		char digits[32];
+		auto [last, error] = std::to_chars(digits, digits + sizeof(digits), value);
+		out.write(digits, last - digits);
+	}
+
+	// Cells outside of the event are left empty, so importing restores its span
+	static bool isKeyed(const Event& e, int frame)
+	{
+		return !e.keyframes.empty() && frame >= e.time && frame <= e.time + e.duration;
+	}
+
+	static std::string readCSVField(ChunkReader& in)
+	{
+		std::string field;
+		if (in.peek() != '"') {
+			for (int c = in.peek(); c != ',' && c != '\n' && c != '\r' && c != EOF; c = in.peek()) field += (char)in.get();
+			return field;
+		}
+		in.get();
+		for (int c = in.get(); c != EOF; c = in.get()) {
+			if (c == '"') {
+				if (in.peek() != '"') break;
+				in.get();
+			}
+			field += (char)c;
+		}
+		return field;
+	}
+
+	// Consumes the line break, if any; false at the end of the file
+	static bool endCSVLine(ChunkReader& in)
+	{
+		while (in.peek() != '\n' && in.peek() != EOF) in.get();
+		if (in.get() == EOF) return false;
+		return in.peek() != EOF;
+	}
+
+	static std::string readJSONString(ChunkReader& in)
+	{
+		std::string text;
+		if (in.get() != '"') return text;
+		for (int c = in.get(); c != '"' && c != EOF; c = in.get()) {
+			if (c != '\\') {
+				text += (char)c;
+				continue;
+			}
+			c = in.get();
+			switch (c) {
+			case 'b': text += '\b'; break;
+			case 'f': text += '\f'; break;
+			case 'n': text += '\n'; break;
+			case 'r': text += '\r'; break;
+			case 't': text += '\t'; break;
+			case 'u': {
+				char hex[4];
+				for (char& h : hex) h = (char)in.get();
+				unsigned code = 0;
+				std::from_chars(hex, hex + 4, code, 16);
+				// UTF-8; surrogate pairs aren't combined
+				if (code < 0x80) text += (char)code;
+				else if (code < 0x800) {
+					text += (char)(0xC0 | code >> 6);
+					text += (char)(0x80 | (code & 0x3F));
+				}
+				else {
+					text += (char)(0xE0 | code >> 12);
+					text += (char)(0x80 | (code >> 6 & 0x3F));
+					text += (char)(0x80 | (code & 0x3F));
+				}
+				break;
+			}
+			default: text += (char)c;
+			}
+		}
+		return text;
+	}
+
+	static void writeJSONString(std::ofstream& out, const std::string& text)
+	{
+		out << '"';
+		for (char c : text) {
+			if (c == '"' || c == '\\') out << '\\' << c;
+			else if ((unsigned char)c < 0x20) {
+				char code[8];
+				snprintf(code, sizeof(code), "\\u%04x", c);
+				out << code;
+			}
+			else out << c;
+		}
+		out << '"';
+	}
+
+	// Skips any JSON value; false if the file ends first
+	static bool skipJSONValue(ChunkReader& in)
+	{
+		in.skipSpaces();
+		int c = in.peek();
+		if (c == '"') {
+			readJSONString(in);
+			return true;
+		}
+		if (c != '{' && c != '[') {
+			while (c != ',' && c != '}' && c != ']' && c != EOF) c = (in.get(), in.peek());
+			return c != EOF;
+		}
+		int depth = 0;
+		do {
+			c = in.peek();
+			if (c == '"') {
+				readJSONString(in);
+				continue;
+			}
+			if (c == '{' || c == '[') depth++;
+			if (c == '}' || c == ']') depth--;
+			in.get();
+		} while (depth > 0 && c != EOF);
+		return c != EOF;
+	}
+
+	// One row of an imported file; reused so that rows don't allocate
+	struct ImportRow {
+		std::vector<float> values;
+		std::vector<bool> present;
+		void reset(size_t columns) {
+			values.assign(columns, 0.0f);
+			present.assign(columns, false);
+		}
+		void set(size_t column, float value) {
+			if (column >= values.size()) return;
+			values[column] = value;
+			present[column] = true;
+		}
+		// The frame is read from the frame column if the row has it
+		void add(std::vector<ImportedKeys>& columns, int frame_column, int frame) {
+			if (frame_column >= 0 && present[frame_column]) frame = (int)std::lround(values[frame_column]);
+			std::shared_ptr<const float> times;
+			for (size_t i = 0; i < columns.size(); i++) {
+				if (present[i] && columns[i].event) columns[i].add(frame, values[i], times);
+			}
+		}
+	};
+
+	void ImportedKeys::add(int frame, float value, std::shared_ptr<const float>& times)
+	{
+		if (is_sorted && !frames.empty() && frame == frames.back()) {
+			values.back() = value;
+			return;
+		}
+		if (is_sorted && !frames.empty() && frame < frames.back()) {
+			// The keys in chunks go back to pending, to be sorted with the others
+			std::vector<int> all_frames(keys.size());
+			for (size_t i = 0; i < all_frames.size(); i++) all_frames[i] = has_gaps ? (int)keys.time(i) : first + (int)i;
+			std::vector<float> all_values = keys.copy();
+			all_frames.insert(all_frames.end(), frames.begin(), frames.end());
+			all_values.insert(all_values.end(), values.begin(), values.end());
+			frames.swap(all_frames);
+			values.swap(all_values);
+			keys.clear();
+			is_sorted = false;
+		}
+		if (is_sorted && !frames.empty() && !has_gaps && frame != frames.back() + 1) {
+			// The keys in chunks get their frames as times
+			has_gaps = true;
+			for (size_t c = 0; c < keys.chunkCount(); c++) {
+				std::vector<float> chunk_frames(keys.chunkSize(c));
+				std::iota(chunk_frames.begin(), chunk_frames.end(), (float)(first + keys.chunkStart(c)));
+				keys.time_chunks.push_back(Keyframes::column(std::move(chunk_frames)));
+			}
+		}
+		if (frames.empty() && keys.empty()) first = frame;
+		frames.push_back(frame);
+		values.push_back(value);
+		// The last key stays pending, as the next row may repeat its frame
+		if (is_sorted && frames.size() > Keyframes::CHUNK) flush(Keyframes::CHUNK, times);
+	}
+
+	void ImportedKeys::flush(size_t n, std::shared_ptr<const float>& times)
+	{
+		if (n == 0) return;
+		keys.chunks.push_back(Keyframes::column(std::vector<float>(values.begin(), values.begin() + n)));
+		if (has_gaps) {
+			bool is_shared = times && n == Keyframes::CHUNK
+				&& std::equal(frames.begin(), frames.begin() + n, times.get(), [](int f, float t) { return (float)f == t; });
+			if (!is_shared) times = Keyframes::column(std::vector<float>(frames.begin(), frames.begin() + n));
+			keys.time_chunks.push_back(times);
+		}
+		if (keys.starts.empty()) keys.starts.push_back(0);
+		keys.starts.push_back(keys.starts.back() + n);
+		frames.erase(frames.begin(), frames.begin() + n);
+		values.erase(values.begin(), values.begin() + n);
+	}
+
+	std::vector<std::string> Sequencer::columnNames() const
+	{
+		std::vector<std::string> names;
+		for (const Track& t : tracks) {
+			for (size_t i = 0; i < t.events.size(); i++) {
+				if (t.events.size() == 1) names.push_back(t.label);
+				else names.push_back(t.label + "." + componentName(i, t.events.size()));
+			}
+		}
+		return names;
+	}
+
+	Event* Sequencer::column(const std::string& name)
+	{
+		for (Track& t : tracks) {
+			if (t.label == name && t.events.size() == 1) return &t.events[0];
+		}
+		size_t dot = name.rfind('.');
+		if (dot == std::string::npos) return nullptr;
+		std::string component = name.substr(dot + 1);
+		for (Track& t : tracks) {
+			if (t.events.size() == 1 || t.label.compare(0, std::string::npos, name, 0, dot) != 0) continue;
+			for (size_t i = 0; i < t.events.size(); i++) {
+				if (componentName(i, t.events.size()) == component) return &t.events[i];
+			}
+		}
+		return nullptr;
+	}
+
+	void Sequencer::imported(std::vector<ImportedKeys>& columns)
+	{
+		std::shared_ptr<const float> last_times;
+		const std::vector<int>* last_frames = nullptr;
+		// Time chunks normalized so far, by the chunk of frames they replace and its span
+		std::map<std::tuple<const float*, int, int>, std::shared_ptr<const float>> normalized;
+		for (ImportedKeys& c : columns) {
+			if (!c.event || (c.frames.empty() && c.keys.empty())) continue;
+			Event& e = *c.event;
+			e.playhead = 0;
+			if (c.is_sorted) {
+				int first = c.first, last = c.frames.back();
+				std::shared_ptr<const float> times;
+				c.flush(c.frames.size(), times);
+				c.keys.updated();
+				float span = std::max(last - first, 1);
+				for (size_t i = 0; i < c.keys.time_chunks.size(); i++) {
+					std::shared_ptr<const float>& chunk = c.keys.time_chunks[i];
+					std::shared_ptr<const float>& done = normalized[{ chunk.get(), first, last }];
+					if (!done) {
+						// A chunk no other column has is normalized in place
+						done = chunk.use_count() > 1 ? Keyframes::column(std::vector<float>(chunk.get(), chunk.get() + c.keys.chunkSize(i))) : chunk;
+						float* chunk_times = const_cast<float*>(done.get());
+						for (size_t k = 0; k < c.keys.chunkSize(i); k++) chunk_times[k] = (chunk_times[k] - first) / span;
+					}
+					chunk = done;
+				}
+				e.time = first;
+				e.duration = last - first;
+				e.keyframes = std::move(c.keys);
+				e.edited();
+				journalKeys(e);
+				continue;
+			}
+
+			// Frames out of order are sorted; a repeated frame keeps its last value
+			std::vector<size_t> order(c.frames.size());
+			std::iota(order.begin(), order.end(), 0);
+			std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return c.frames[a] < c.frames[b]; });
+			std::vector<int> frames;
+			std::vector<float> values;
+			for (size_t i : order) {
+				if (!frames.empty() && frames.back() == c.frames[i]) {
+					values.back() = c.values[i];
+					continue;
+				}
+				frames.push_back(c.frames[i]);
+				values.push_back(c.values[i]);
+			}
+			c.frames.swap(frames);
+			size_t n = c.frames.size();
+			int first = c.frames.front(), last = c.frames.back();
+			e.time = first;
+			e.duration = last - first;
+			if (last - first + 1 == (int)n) {
+				e.keyframes.assign(std::move(values));
+			}
+			else {
+				// Components of a track usually share their frames, and so the time column
+				if (!last_frames || *last_frames != c.frames) {
+					last_times = Keyframes::frameTimes(c.frames);
+					last_frames = &c.frames;
+				}
+				e.keyframes.assign(std::move(values), last_times);
+			}
+			e.edited();
+			journalKeys(e);
+		}
+		index.dirty = true;
+		updateRecordingTracks();
+		checkpoint();
+	}
+
+	bool Sequencer::exportCSV(std::string path) const
+	{
+		std::ofstream out(path, std::ios::binary);
+		if (!out) {
+			std::cout << "Could not write " << path << std::endl;
+			return false;
+		}
+		out << "frame";
+		for (const std::string& name : columnNames()) {
+			out << ",\"";
+			for (char c : name) out << (c == '"' ? "\"\"" : std::string(1, c));
+			out << '"';
+		}
+		out << '\n';
+
+		std::vector<const Event*> events;
+		for (const Track& t : tracks) for (const Event& e : t.events) events.push_back(&e);
+		int n = channels();
+		std::vector<int> frames(EXCHANGE_CHUNK);
+		std::vector<float> values((size_t)n * EXCHANGE_CHUNK);
+		for (int from = state.range[0]; from <= state.range[1]; from += EXCHANGE_CHUNK) {
+			int count = std::min(EXCHANGE_CHUNK, state.range[1] - from + 1);
+			std::iota(frames.begin(), frames.begin() + count, from);
+			evaluate(frames.data(), count, values.data());
+			for (int i = 0; i < count; i++) {
+				out << frames[i];
+				for (int c = 0; c < n; c++) {
+					out << ',';
+					if (isKeyed(*events[c], frames[i])) writeNumber(out, values[(size_t)c * count + i]);
+				}
+				out << '\n';
+			}
+		}
+		return (bool)out;
+	}
+
+	bool Sequencer::exportJSON(std::string path) const
+	{
+		std::ofstream out(path, std::ios::binary);
+		if (!out) {
+			std::cout << "Could not write " << path << std::endl;
+			return false;
+		}
+		out << "{\"fps\": " << fps << ", \"columns\": [\"frame\"";
+		for (const std::string& name : columnNames()) {
+			out << ", ";
+			writeJSONString(out, name);
+		}
+		out << "], \"rows\": [";
+
+		std::vector<const Event*> events;
+		for (const Track& t : tracks) for (const Event& e : t.events) events.push_back(&e);
+		int n = channels();
+		std::vector<int> frames(EXCHANGE_CHUNK);
+		std::vector<float> values((size_t)n * EXCHANGE_CHUNK);
+		for (int from = state.range[0]; from <= state.range[1]; from += EXCHANGE_CHUNK) {
+			int count = std::min(EXCHANGE_CHUNK, state.range[1] - from + 1);
+			std::iota(frames.begin(), frames.begin() + count, from);
+			evaluate(frames.data(), count, values.data());
+			for (int i = 0; i < count; i++) {
+				out << (from == state.range[0] && i == 0 ? "\n[" : ",\n[") << frames[i];
+				for (int c = 0; c < n; c++) {
+					float value = values[(size_t)c * count + i];
+					out << ", ";
+					if (isKeyed(*events[c], frames[i]) && std::isfinite(value)) writeNumber(out, value);
+					else out << "null";
+				}
+				out << ']';
+			}
+		}
+		out << "\n]}\n";
+		return (bool)out;
+	}
+
+	bool Sequencer::importCSV(std::string path)
+	{
+		ChunkReader in(path);
+		if (!in.isOpen()) {
+			std::cout << "Could not open " << path << std::endl;
+			return false;
+		}
+		// Header: the frame column, if there's none the rows are numbered from the range start
+		std::vector<ImportedKeys> columns;
+		int frame_column = -1;
+		do {
+			std::string name = readCSVField(in);
+			if (name == "frame") frame_column = columns.size();
+			Event* event = name == "frame" ? nullptr : column(name);
+			if (!event && name != "frame") std::cout << path << ": skipping column " << name << " which isn't tracked" << std::endl;
+			columns.push_back({ event });
+		} while (in.get() == ',');
+		if (in.peek() == '\n') in.get();
+
+		ImportRow row;
+		for (int frame = state.range[0]; in.peek() != EOF; frame++) {
+			row.reset(columns.size());
+			for (size_t i = 0; i < columns.size(); i++) {
+				if (i > 0 && in.get() != ',') break;
+				float value;
+				if (readNumber(in, value)) row.set(i, value);
+			}
+			row.add(columns, frame_column, frame);
+			if (!endCSVLine(in)) break;
+		}
+		imported(columns);
+		return true;
+	}
+
+	bool Sequencer::importJSON(std::string path)
+	{
+		ChunkReader in(path);
+		if (!in.isOpen()) {
+			std::cout << "Could not open " << path << std::endl;
+			return false;
+		}
+		auto fail = [&](const char* reason) {
+			std::cout << path << ": " << reason << std::endl;
+			return false;
+		};
+		// { "fps": 30, "columns": ["frame", "label.x", ...], "rows": [[0, 1.5, ...], ...] }
+		std::vector<ImportedKeys> columns;
+		int frame_column = -1;
+		int file_fps = fps;
+		in.skipSpaces();
+		if (in.get() != '{') return fail("expected an object");
+		for (;;) {
+			in.skipSpaces();
+			if (in.peek() == '}') break;
+			std::string key = readJSONString(in);
+			in.skipSpaces();
+			if (in.get() != ':') return fail("expected a key");
+			in.skipSpaces();
+			if (key == "fps") {
+				float value;
+				if (!readNumber(in, value)) return fail("bad fps");
+				file_fps = (int)std::lround(value);
+			}
+			else if (key == "columns") {
+				if (in.get() != '[') return fail("expected the column names");
+				for (in.skipSpaces(); in.peek() == '"'; in.skipSpaces()) {
+					std::string name = readJSONString(in);
+					if (name == "frame") frame_column = columns.size();
+					Event* event = name == "frame" ? nullptr : column(name);
+					if (!event && name != "frame") std::cout << path << ": skipping column " << name << " which isn't tracked" << std::endl;
+					columns.push_back({ event });
+					in.skipSpaces();
+					if (in.peek() == ',') in.get();
+				}
+				if (in.get() != ']') return fail("expected the column names");
+			}
+			else if (key == "rows") {
+				if (in.get() != '[') return fail("expected the rows");
+				ImportRow row;
+				int frame = state.range[0];
+				for (in.skipSpaces(); in.peek() == '['; in.skipSpaces()) {
+					in.get();
+					row.reset(columns.size());
+					for (size_t i = 0; ; i++) {
+						in.skipSpaces();
+						if (in.peek() == ']' || in.peek() == EOF) break;
+						float value;
+						int c = in.peek();
+						if ((isdigit(c) || c == '-') && readNumber(in, value)) row.set(i, value);
+						// null, or a value of an unexpected type
+						else if (!skipJSONValue(in)) return fail("unexpected end of the rows");
+						in.skipSpaces();
+						if (in.peek() == ',') in.get();
+					}
+					if (in.get() != ']') return fail("unexpected end of the rows");
+					row.add(columns, frame_column, frame++);
+					in.skipSpaces();
+					if (in.peek() == ',') in.get();
+				}
+				if (in.get() != ']') return fail("expected the rows");
+			}
+			else if (!skipJSONValue(in)) return fail("unexpected end of the file");
+			in.skipSpaces();
+			if (in.peek() == ',') in.get();
+			else if (in.peek() != '}') return fail("expected a comma");
+		}
+		if (file_fps > 0 && file_fps != fps) {
+			std::cout << path << ": fps changed from " << fps << " to " << file_fps << std::endl;
+			fps = file_fps;
+		}
+		imported(columns);
+		return true;
+	}
+}
@@ -0,0 +1,289 @@
+#include "VRaFFilter.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace VRaF {
+
+	// Time steps gathered into a lane-interleaved block at a time
+	constexpr size_t FILTER_BLOCK = 256;
+	constexpr float PI = 3.14159265358979f;
+
+	std::vector<Biquad> butterworth(int order, float cutoff)
+	{
+		// Same design as scipy's signal.butter(order, cutoff); e.g. for
+		// order 1 and cutoff 0.4, b = { 0.42080778, 0.42080778 }, a = { 1, -0.15838444 }
+		order = std::clamp(order, 1, MAX_SECTIONS * 2);
+		cutoff = std::clamp(cutoff, 0.001f, 0.999f);
+		float k = tan(PI * cutoff / 2);
+		std::vector<Biquad> sections;
+		for (int i = 0; i < order / 2; i++) {
+			// Analog pole pair: s^2 + d s + 1
+			float d = 2 * sin(PI * (2 * i + 1) / (2 * order));
+			float norm = 1 + d * k + k * k;
+			float b0 = k * k / norm;
+			sections.push_back({ b0, 2 * b0, b0, 2 * (k * k - 1) / norm, (1 - d * k + k * k) / norm });
+		}
+		if (order % 2) {
+			float b0 = k / (1 + k);
+			sections.push_back({ b0, b0, 0, (k - 1) / (k + 1), 0 });
+		}
+		return sections;
+	}
+
+	float OneEuro::operator()(float x)
+	{
+		auto alpha = [&](float cutoff) {
+			float tau = 1 / (2 * PI * cutoff);
+			return 1 / (1 + tau * settings.rate);
+		};
+		if (!initialized) {
+			initialized = true;
+			x_prev = x;
+			dx_prev = 0;
+			return x;
+		}
+		float dx = (x - x_prev) * settings.rate;
+		dx_prev += alpha(settings.d_cutoff) * (dx - dx_prev);
+		float cutoff = settings.min_cutoff + settings.beta * fabs(dx_prev);
+		x_prev += alpha(cutoff) * (x - x_prev);
+		return x_prev;
+	}
+
+	static void biquadLanes(float* const* channels, int lanes, size_t length,
+		const std::vector<Biquad>& sections, bool is_backwards)
+	{
+		alignas(32) float block[FILTER_BLOCK][FILTER_LANES] = {};
+		// Per section history: x1, x2, y1, y2
+		alignas(32) float state[MAX_SECTIONS][4][FILTER_LANES] = {};
+		int n_sections = std::min((int)sections.size(), MAX_SECTIONS);
+
+		auto index = [&](size_t i) { return is_backwards ? length - 1 - i : i; };
+		// Start from steady state at the first sample; low-pass sections have unit DC gain
+		for (int s = 0; s < n_sections; s++) {
+			for (int h = 0; h < 4; h++) {
+				for (int l = 0; l < lanes; l++) state[s][h][l] = channels[l][index(0)];
+			}
+		}
+
+		for (size_t begin = 0; begin < length; begin += FILTER_BLOCK) {
+			size_t n = std::min(FILTER_BLOCK, length - begin);
+			for (int l = 0; l < lanes; l++) {
+				for (size_t i = 0; i < n; i++) block[i][l] = channels[l][index(begin + i)];
+			}
+			for (int s = 0; s < n_sections; s++) {
+				const Biquad& q = sections[s];
+				float* x1 = state[s][0];
+				float* x2 = state[s][1];
+				float* y1 = state[s][2];
+				float* y2 = state[s][3];
+				for (size_t i = 0; i < n; i++) {
+					for (int l = 0; l < FILTER_LANES; l++) {
+						float x = block[i][l];
+						float y = q.b0 * x + q.b1 * x1[l] + q.b2 * x2[l] - q.a1 * y1[l] - q.a2 * y2[l];
+						x2[l] = x1[l];
+						x1[l] = x;
+						y2[l] = y1[l];
+						y1[l] = y;
+						block[i][l] = y;
+					}
+				}
+			}
+			for (int l = 0; l < lanes; l++) {
+				for (size_t i = 0; i < n; i++) channels[l][index(begin + i)] = block[i][l];
+			}
+		}
+	}
+
+	void biquads(float* const* channels, int count, size_t length,
+		const std::vector<Biquad>& sections, bool is_backwards)
+	{
+		if (length == 0) return;
+		for (int c = 0; c < count; c += FILTER_LANES) {
+			biquadLanes(channels + c, std::min(FILTER_LANES, count - c), length, sections, is_backwards);
+		}
+	}
+
+	// Convolution weights of the least-squares polynomial fit over -m..m,
+	// evaluated at offset 'at': 0 is the window center, m its newest sample
+	static std::vector<float> savitzkyGolay(int half_window, int degree, int at = 0)
+	{
+		int m = half_window;
+		int p = std::clamp(degree, 0, 2 * m);
+		int n = p + 1;
+		// Normal equations (J^T J) c = v, with J[j][k] = j^k and v[k] = at^k
+		std::vector<double> a(n * (n + 1), 0);
+		for (int r = 0; r < n; r++) {
+			for (int c = 0; c < n; c++) {
+				for (int j = -m; j <= m; j++) a[r * (n + 1) + c] += pow(j, r + c);
+			}
+			a[r * (n + 1) + n] = pow(at, r);
+		}
+		// Gauss-Jordan with partial pivoting
+		for (int c = 0; c < n; c++) {
+			int pivot = c;
+			for (int r = c + 1; r < n; r++) {
+				if (fabs(a[r * (n + 1) + c]) > fabs(a[pivot * (n + 1) + c])) pivot = r;
+			}
+			for (int k = 0; k <= n; k++) std::swap(a[c * (n + 1) + k], a[pivot * (n + 1) + k]);
+			for (int r = 0; r < n; r++) {
+				if (r == c) continue;
+				double f = a[r * (n + 1) + c] / a[c * (n + 1) + c];
+				for (int k = c; k <= n; k++) a[r * (n + 1) + k] -= f * a[c * (n + 1) + k];
+			}
+		}
+		std::vector<float> weights(2 * m + 1);
+		for (int j = -m; j <= m; j++) {
+			double w = 0;
+			for (int k = 0; k < n; k++) w += a[k * (n + 1) + n] / a[k * (n + 1) + k] * pow(j, k);
+			weights[j + m] = (float)w;
+		}
+		return weights;
+	}
+
+	LiveFilter::LiveFilter(const FilterSettings& settings) : settings(settings), one_euro{ settings }
+	{
+		if (settings.type == FILTER_BUTTERWORTH) {
+			std::vector<Biquad> design = butterworth(settings.order, settings.cutoff);
+			n_sections = std::min((int)design.size(), MAX_SECTIONS);
+			std::copy(design.begin(), design.begin() + n_sections, sections);
+		}
+		else if (settings.type == FILTER_SAVITZKY_GOLAY) {
+			int m = std::clamp(settings.half_window, 1, MAX_HALF_WINDOW);
+			window = 2 * m + 1;
+			std::vector<float> w = savitzkyGolay(m, settings.degree, m);
+			std::copy(w.begin(), w.end(), weights);
+		}
+	}
+
+	float LiveFilter::operator()(float x)
+	{
+		if (settings.type == FILTER_ONE_EURO) return one_euro(x);
+		if (!initialized) {
+			// Steady state at the first sample, as in the offline filters
+			initialized = true;
+			for (int s = 0; s < n_sections; s++) {
+				for (int h = 0; h < 4; h++) state[s][h] = x;
+			}
+			for (int i = 0; i < window; i++) history[i] = x;
+			return x;
+		}
+		if (settings.type == FILTER_BUTTERWORTH) {
+			for (int s = 0; s < n_sections; s++) {
+				const Biquad& q = sections[s];
+				float* h = state[s];
+				float y = q.b0 * x + q.b1 * h[0] + q.b2 * h[1] - q.a1 * h[2] - q.a2 * h[3];
+				h[1] = h[0];
+				h[0] = x;
+				h[3] = h[2];
+				h[2] = y;
+				x = y;
+			}
+			return x;
+		}
+		// Savitzky-Golay: history is a ring, weights go from oldest to newest
+		newest = (newest + 1) % window;
+		history[newest] = x;
+		float y = 0;
+		for (int j = 0; j < window; j++) y += weights[j] * history[(newest + 1 + j) % window];
+		return y;
+	}
+
+	void filter(float* const* channels, int count, size_t length, const FilterSettings& settings)
+	{
+		if (length == 0) return;
+		if (settings.type == FILTER_BUTTERWORTH) {
+			std::vector<Biquad> sections = butterworth(settings.order, settings.cutoff);
+			biquads(channels, count, length, sections, false);
+			biquads(channels, count, length, sections, true);
+		}
+		else if (settings.type == FILTER_SAVITZKY_GOLAY) {
+			int m = std::max(settings.half_window, 1);
+			std::vector<float> weights = savitzkyGolay(m, settings.degree);
+			// The input padded with its edge values on both sides
+			std::vector<float> padded(length + 2 * m);
+			for (int c = 0; c < count; c++) {
+				float* x = channels[c];
+				std::fill(padded.begin(), padded.begin() + m, x[0]);
+				std::copy(x, x + length, padded.begin() + m);
+				std::fill(padded.end() - m, padded.end(), x[length - 1]);
+				for (size_t i = 0; i < length; i++) {
+					float y = 0;
+					for (int j = 0; j <= 2 * m; j++) y += weights[j] * padded[i + j];
+					x[i] = y;
+				}
+			}
+		}
+		else if (settings.type == FILTER_ONE_EURO) {
+			// Forward and backward, so that the result isn't delayed
+			for (int c = 0; c < count; c++) {
+				float* x = channels[c];
+				OneEuro forward{ settings };
+				for (size_t i = 0; i < length; i++) x[i] = forward(x[i]);
+				OneEuro backward{ settings };
+				for (size_t i = length; i-- > 0; ) x[i] = backward(x[i]);
+			}
+		}
+	}
+
+	void fitBSpline(const float* const* channels, int count, size_t length, const float* times,
+		size_t points, float smoothing, float* const* out)
+	{
+		// Normal equations (B^T B + lambda D^T D) c = B^T y. Every key touches
+		// 4 neighbouring control points, so the matrix has 3 off-diagonals:
+		// a[i][k] holds A(i, i + k)
+		size_t m = points, segments = points - 3;
+		std::vector<std::array<double, 4>> a(m, { 0, 0, 0, 0 });
+		std::vector<size_t> first(length);
+		std::vector<std::array<float, 4>> weights(length);
+		for (size_t j = 0; j < length; j++) {
+			float t = times ? times[j] : length > 1 ? (float)j / (length - 1) : 0.0f;
+			float u = std::clamp(t, 0.0f, 1.0f) * segments;
+			size_t i = std::min((size_t)u, segments - 1);
+			bsplineBasis(u - i, weights[j].data());
+			first[j] = i;
+			for (int p = 0; p < 4; p++) {
+				for (int q = p; q < 4; q++) a[i + p][q - p] += weights[j][p] * weights[j][q];
+			}
+		}
+		// Scaled by the keys per control point, so that the same smoothing
+		// gives about the same curve for any number of points
+		double lambda = smoothing * (double)length / m;
+		const double d[3] = { 1, -2, 1 };
+		for (size_t i = 0; i + 2 < m; i++) {
+			for (int p = 0; p < 3; p++) {
+				for (int q = p; q < 3; q++) a[i + p][q - p] += lambda * d[p] * d[q];
+			}
+		}
+		// Keeps control points without any keys nearby defined
+		for (size_t i = 0; i < m; i++) a[i][0] += 1e-9;
+
+		// Banded Cholesky, A = L L^T with l[i][k] = L(i, i - k)
+		std::vector<std::array<double, 4>> l(m, { 0, 0, 0, 0 });
+		for (size_t i = 0; i < m; i++) {
+			for (size_t j = i >= 3 ? i - 3 : 0; j <= i; j++) {
+				double sum = a[j][i - j];
+				for (size_t r = i >= 3 ? i - 3 : 0; r < j; r++) sum -= l[i][i - r] * l[j][j - r];
+				if (j == i) l[i][0] = sqrt(std::max(sum, 1e-300));
+				else l[i][i - j] = sum / l[j][0];
+			}
+		}
+
+		std::vector<double> c(m);
+		for (int channel = 0; channel < count; channel++) {
+			std::fill(c.begin(), c.end(), 0.0);
+			for (size_t j = 0; j < length; j++) {
+				for (int p = 0; p < 4; p++) c[first[j] + p] += weights[j][p] * channels[channel][j];
+			}
+			for (size_t i = 0; i < m; i++) {
+				for (size_t r = i >= 3 ? i - 3 : 0; r < i; r++) c[i] -= l[i][i - r] * c[r];
+				c[i] /= l[i][0];
+			}
+			for (size_t i = m; i-- > 0; ) {
+				for (size_t r = i + 1; r < std::min(m, i + 4); r++) c[i] -= l[r][r - i] * c[r];
+				c[i] /= l[i][0];
+			}
+			for (size_t i = 0; i < m; i++) out[channel][i] = (float)c[i];
+		}
+	}
+}
@@ -0,0 +1,122 @@
+#include "VRaFSequencer.h"
+#include <algorithm>
+
+namespace VRaF {
+
+	void Sequencer::checkpoint(bool is_step)
+	{
+		auto stateOf = [](const Event& e) -> EventState {
+			return { e.time, e.duration, e.interpolation, e.keyframes.starts, e.keyframes.time_chunks };
+		};
+		std::vector<EventChange> changes;
+		history.is_dirty = false;
+		history.states.resize(tracks.size());
+		history.keys.resize(tracks.size());
+		for (size_t t = 0; t < tracks.size(); t++) {
+			std::vector<EventState>& states = history.states[t];
+			std::vector<Keyframes>& keys = history.keys[t];
+			states.resize(tracks[t].events.size());
+			keys.resize(tracks[t].events.size());
+			for (size_t i = 0; i < states.size(); i++) {
+				const Event& e = tracks[t].events[i];
+				EventChange change = { t, i, states[i], stateOf(e) };
+				// Chunks are compared by address; unchanged ones are still shared.
+				// A splice changing the number of chunks shifts the ones after it,
+				// so those are matched from the end
+				const auto& before = keys[i].chunks;
+				const auto& after = e.keyframes.chunks;
+				size_t same = std::min(before.size(), after.size()), first = 0, last = 0;
+				while (first < same && before[first] == after[first]) first++;
+				while (last < same - first && before[before.size() - 1 - last] == after[after.size() - 1 - last]) last++;
+				change.first = first;
+				change.before_chunks.assign(before.begin() + first, before.end() - last);
+				change.after_chunks.assign(after.begin() + first, after.end() - last);
+				if (change.before_chunks.empty() && change.after_chunks.empty() && change.before == change.after) continue;
+				states[i] = change.after;
+				keys[i] = e.keyframes;
+				if (is_step) changes.push_back(std::move(change));
+			}
+		}
+		if (changes.empty()) return;
+		// A new edit drops the undone steps
+		history.steps.resize(history.done);
+		history.steps.push_back(std::move(changes));
+		if (history.steps.size() > history.limit) history.steps.erase(history.steps.begin());
+		history.done = history.steps.size();
+	}
+
+	void Sequencer::restore(const EventChange& change, bool is_undo)
+	{
+		if (change.track >= tracks.size() || change.event >= tracks[change.track].events.size()) return;
+		Event& e = tracks[change.track].events[change.event];
+		const EventState& state = is_undo ? change.before : change.after;
+		const EventState& replaced = is_undo ? change.after : change.before;
+		const auto& chunks = is_undo ? change.before_chunks : change.after_chunks;
+		const auto& replaced_chunks = is_undo ? change.after_chunks : change.before_chunks;
+		if (e.keyframes.chunks.size() < change.first + replaced_chunks.size()) return;
+		// Only the replaced chunks are swapped, in the event and in the checkpoint
+		for (Keyframes* k : { &e.keyframes, &history.keys[change.track][change.event] }) {
+			auto at = k->chunks.erase(k->chunks.begin() + change.first, k->chunks.begin() + change.first + replaced_chunks.size());
+			k->chunks.insert(at, chunks.begin(), chunks.end());
+			k->starts = state.starts;
+			k->time_chunks = state.times;
+			k->updated();
+		}
+		history.states[change.track][change.event] = state;
+		e.time = state.time;
+		e.duration = state.duration;
+		e.interpolation = state.interpolation;
+		e.playhead = 0;
+		e.edited();
+
+		// The journal gets the keys of the swapped chunks, as splices of the
+		// replaced ones. Keys that got or lost their times are all new
+		if (!journal) return;
+		if (state.starts.empty() || replaced.starts.empty() || state.times.empty() != replaced.times.empty()) {
+			journalKeys(e);
+			return;
+		}
+		size_t c = change.first, end = c + chunks.size();
+		if (state.starts != replaced.starts) {
+			journalSplice(e, state.starts[c], replaced.starts[c + replaced_chunks.size()], state.starts[end] - state.starts[c]);
+			return;
+		}
+		// Same layout: each run of swapped chunks is a splice of its own
+		bool is_journaled = false;
+		while (c < end) {
+			if (chunks[c - change.first] == replaced_chunks[c - change.first]) {
+				c++;
+				continue;
+			}
+			size_t from = c;
+			while (c < end && chunks[c - change.first] != replaced_chunks[c - change.first]) c++;
+			journalSplice(e, state.starts[from], state.starts[c], state.starts[c] - state.starts[from]);
+			is_journaled = true;
+		}
+		// Still needed for the time, duration and interpolation
+		if (!is_journaled) journalSplice(e, 0, 0, 0);
+	}
+
+	void Sequencer::undo()
+	{
+		// Edits not checkpointed yet are undone first
+		if (history.is_dirty) checkpoint();
+		if (!canUndo()) return;
+		history.done--;
+		const std::vector<EventChange>& step = history.steps[history.done];
+		for (auto change = step.rbegin(); change != step.rend(); change++) restore(*change, true);
+		index.dirty = true;
+		updateRecordingTracks();
+	}
+
+	void Sequencer::redo()
+	{
+		// Edits not checkpointed yet drop the undone steps
+		if (history.is_dirty) checkpoint();
+		if (!canRedo()) return;
+		for (const EventChange& change : history.steps[history.done]) restore(change, false);
+		history.done++;
+		index.dirty = true;
+		updateRecordingTracks();
+	}
+}
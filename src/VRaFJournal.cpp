@@ -0,0 +1,410 @@
+#include "VRaFJournal.h"
+#include "VRaFSequencer.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+namespace fs = std::filesystem;
+
+namespace VRaF {
+
+	// The writer waits this long for more records, unless this many bytes are pending
+	constexpr auto JOURNAL_INTERVAL = std::chrono::milliseconds(250);
+	constexpr size_t JOURNAL_BATCH = 1 << 16;
+
+	static uint32_t checksum(uint8_t type, const uint8_t* data, size_t size)
+	{
+		uint32_t hash = 2166136261u;
+		hash = (hash ^ type) * 16777619u;
+		for (size_t i = 0; i < size; i++) hash = (hash ^ data[i]) * 16777619u;
+		return hash;
+	}
+
+	JournalRecord& JournalRecord::operator<<(const std::string& text)
+	{
+		*this << (uint32_t)text.size();
+		data.insert(data.end(), text.begin(), text.end());
+		return *this;
+	}
+
+	std::string JournalReader::readString()
+	{
+		uint32_t size = read<uint32_t>();
+		if ((size_t)(end - at) < size) is_valid = false;
+		if (!is_valid) return "";
+		std::string text((const char*)at, size);
+		at += size;
+		return text;
+	}
+
+	Journal::Journal(const std::string& path)
+	{
+		file = fopen(path.c_str(), "ab");
+		if (!file) {
+			std::cout << "Could not open " << path << std::endl;
+			return;
+		}
+		if (ftell(file) == 0) {
+			fwrite(JOURNAL_MAGIC, 1, sizeof(JOURNAL_MAGIC), file);
+			fwrite(&JOURNAL_VERSION, sizeof(JOURNAL_VERSION), 1, file);
+		}
+		writer = std::thread(&Journal::run, this);
+	}
+
+	Journal::~Journal()
+	{
+		if (!file) return;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			is_stopping = true;
+		}
+		wake.notify_one();
+		writer.join();
+		fclose(file);
+	}
+
+	void Journal::append(const JournalRecord& record)
+	{
+		if (!file) return;
+		uint32_t size = record.data.size();
+		uint32_t sum = checksum(record.type, record.data.data(), size);
+		std::lock_guard<std::mutex> lock(mutex);
+		const uint8_t* bytes = (const uint8_t*)&size;
+		pending.insert(pending.end(), bytes, bytes + sizeof(size));
+		pending.push_back(record.type);
+		pending.insert(pending.end(), record.data.begin(), record.data.end());
+		bytes = (const uint8_t*)&sum;
+		pending.insert(pending.end(), bytes, bytes + sizeof(sum));
+		appended += sizeof(size) + 1 + size + sizeof(sum);
+		if (pending.size() >= JOURNAL_BATCH) wake.notify_one();
+	}
+
+	void Journal::flush()
+	{
+		if (!file) return;
+		std::unique_lock<std::mutex> lock(mutex);
+		uint64_t target = appended;
+		is_flushing = true;
+		wake.notify_one();
+		written.wait(lock, [&]() { return flushed >= target; });
+		is_flushing = false;
+	}
+
+	void Journal::run()
+	{
+		std::vector<uint8_t> batch;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			wake.wait_for(lock, JOURNAL_INTERVAL, [&]() { return is_stopping || is_flushing || pending.size() >= JOURNAL_BATCH; });
+			bool is_last = is_stopping;
+			batch.swap(pending);
+			lock.unlock();
+			if (!batch.empty()) {
+				fwrite(batch.data(), 1, batch.size(), file);
+				fflush(file);
+#ifdef _WIN32
+				_commit(_fileno(file));
+#else
+				fsync(fileno(file));
+#endif
+			}
+			lock.lock();
+			flushed += batch.size();
+			batch.clear();
+			written.notify_all();
+			if (is_last && pending.empty()) return;
+		}
+	}
+
+	bool Journal::replay(const std::string& path, const std::function<void(JournalRecordType, JournalReader&)>& apply)
+	{
+		FILE* in = fopen(path.c_str(), "rb");
+		if (!in) return false;
+		char magic[sizeof(JOURNAL_MAGIC)];
+		uint32_t version = 0;
+		bool is_journal = fread(magic, 1, sizeof(magic), in) == sizeof(magic) && memcmp(magic, JOURNAL_MAGIC, sizeof(magic)) == 0
+			&& fread(&version, sizeof(version), 1, in) == 1 && version <= JOURNAL_VERSION;
+		std::vector<uint8_t> data;
+		while (is_journal) {
+			uint32_t size, sum;
+			uint8_t type;
+			if (fread(&size, sizeof(size), 1, in) != 1 || fread(&type, 1, 1, in) != 1) break;
+			// Reads in steps, so a corrupt size can't allocate more than the file holds
+			data.clear();
+			for (size_t left = size; left > 0; ) {
+				size_t step = std::min(left, JOURNAL_BATCH);
+				data.resize(data.size() + step);
+				if (fread(data.data() + data.size() - step, 1, step, in) != step) break;
+				left -= step;
+			}
+			if (data.size() != size || fread(&sum, sizeof(sum), 1, in) != 1 || sum != checksum(type, data.data(), size)) break;
+			JournalReader reader = { data.data(), data.data() + size };
+			apply((JournalRecordType)type, reader);
+		}
+		fclose(in);
+		return is_journal;
+	}
+
+	// The event is named by its track label and its component, so that the
+	// journal can be replayed into a sequencer set up by the next run
+	JournalRecord Sequencer::journalRecord(JournalRecordType type, const Event& event) const
+	{
+		JournalRecord record(type);
+		for (const Track& t : tracks) {
+			for (size_t i = 0; i < t.events.size(); i++) {
+				if (&t.events[i] == &event) record << t.label << (uint8_t)i;
+			}
+		}
+		return record;
+	}
+
+	Event* Sequencer::journaledEvent(JournalReader& in)
+	{
+		std::string label = in.readString();
+		uint8_t component = in.read<uint8_t>();
+		for (Track& t : tracks) {
+			if (t.label == label && component < t.events.size()) return &t.events[component];
+		}
+		return nullptr;
+	}
+
+	void Sequencer::journalKeys(const Event& e)
+	{
+		if (!journal) return;
+		JournalRecord record = journalRecord(JOURNAL_KEYS, e);
+		record << e.time << e.duration << (uint32_t)e.interpolation << (uint64_t)e.keyframes.size() << (uint8_t)!e.keyframes.uniform();
+		for (size_t c = 0; c < e.keyframes.chunkCount(); c++) record.write(e.keyframes.chunk(c), e.keyframes.chunkSize(c));
+		for (size_t c = 0; c < e.keyframes.chunkCount() && !e.keyframes.uniform(); c++) record.write(e.keyframes.timeChunk(c), e.keyframes.chunkSize(c));
+		journal->append(record);
+	}
+
+	void Sequencer::journalFilter(const Event& e, const FilterSettings& settings)
+	{
+		if (!journal) return;
+		// Field by field, so the layout doesn't depend on the struct: the same
+		// 36 bytes as the raw struct of version 1 records
+		JournalRecord record = journalRecord(JOURNAL_FILTER, e);
+		record << (uint32_t)settings.type << settings.cutoff << (int32_t)settings.order << (int32_t)settings.half_window
+			<< (int32_t)settings.degree << settings.min_cutoff << settings.beta << settings.d_cutoff << settings.rate;
+		journal->append(record);
+	}
+
+	void Sequencer::journalSplice(const Event& e, size_t from, size_t to, size_t n)
+	{
+		if (!journal) return;
+		JournalRecord record = journalRecord(JOURNAL_SPLICE, e);
+		const Keyframes& k = e.keyframes;
+		record << e.time << e.duration << (uint32_t)e.interpolation << (uint64_t)from << (uint64_t)to << (uint64_t)n
+			<< (uint8_t)!k.uniform();
+		// Only the new keys are written, from the chunks holding them
+		auto add = [&](auto chunk) {
+			for (size_t c = n > 0 ? k.locate(from) : k.chunkCount(); c < k.chunkCount() && k.chunkStart(c) < from + n; c++) {
+				size_t lo = std::max(from, k.chunkStart(c)), hi = std::min(from + n, k.chunkStart(c) + k.chunkSize(c));
+				record.write(chunk(c) + lo - k.chunkStart(c), hi - lo);
+			}
+		};
+		add([&](size_t c) { return k.chunk(c); });
+		if (!k.uniform()) add([&](size_t c) { return k.timeChunk(c); });
+		journal->append(record);
+	}
+
+	void Sequencer::journalSamples()
+	{
+		// Recordings store a frame once no later sample can replace it
+		for (size_t t : recording_tracks) {
+			for (Recording& r : tracks[t].recordings) {
+				if (r.values.size() == r.journaled) continue;
+				for (const Event& e : tracks[t].events) {
+					if (e.target != r.target) continue;
+					size_t count = r.values.size() - r.journaled;
+					JournalRecord record = journalRecord(JOURNAL_SAMPLES, e);
+					record << (int32_t)(r.start + r.journaled) << (uint64_t)count << (uint8_t)!r.frames.empty();
+					record.write(r.values.data() + r.journaled, count);
+					if (!r.frames.empty()) record.write(r.frames.data() + r.journaled, count);
+					journal->append(record);
+					r.journaled += count;
+				}
+			}
+		}
+	}
+
+	bool Sequencer::autosave(std::string path)
+	{
+		journal.reset();
+		if (path.empty()) return true;
+
+		// Recordings the journal doesn't see committed, e.g. cut short by a crash, are recovered too
+		struct Pending {
+			Event* event;
+			int start;
+			std::vector<float> values;
+			std::vector<int> frames;  // Change-driven recordings only
+			int crossfade = 0;
+		};
+		std::vector<Pending> pending;
+		auto recording = [&](Event* e) {
+			auto p = std::find_if(pending.begin(), pending.end(), [&](const Pending& p) { return p.event == e; });
+			return p == pending.end() ? nullptr : &*p;
+		};
+		auto commit = [&](Pending& p) {
+			p.event->splice(p.start, std::move(p.values), p.frames, p.crossfade);
+		};
+		// Recordings cut short are spliced with the current track settings
+		auto crossfade = [&](const Event* e) {
+			for (const Track& t : tracks) {
+				if (e >= t.events.data() && e < t.events.data() + t.events.size()) return t.crossfade;
+			}
+			return 0;
+		};
+
+		bool is_replayed = Journal::replay(path, [&](JournalRecordType type, JournalReader& in) {
+			Event* e = journaledEvent(in);
+			if (!in.is_valid || !e) return;
+			Pending* p = recording(e);
+			switch (type) {
+			case JOURNAL_SAMPLES: {
+				int frame = in.read<int32_t>();
+				uint64_t count = in.read<uint64_t>();
+				bool has_frames = in.read<uint8_t>();
+				if (!in.is_valid) return;
+				if (!p) {
+					pending.push_back({ e, frame, {}, {}, crossfade(e) });
+					p = &pending.back();
+				}
+				if (!has_frames) p->values.resize(std::clamp(frame - p->start, 0, (int)p->values.size()));
+				in.read(p->values, count);
+				if (has_frames) in.read(p->frames, count);
+				if (p->frames.size() != (has_frames ? p->values.size() : 0)) pending.erase(pending.begin() + (p - pending.data()));
+				break;
+			}
+			case JOURNAL_COMMIT: {
+				int start = in.read<int32_t>();
+				uint64_t journaled = in.read<uint64_t>();
+				uint64_t count = in.read<uint64_t>();
+				bool has_frames = in.read<uint8_t>();
+				int fade = in.read<int32_t>();
+				if (!p) {
+					pending.push_back({ e, start });
+					p = &pending.back();
+				}
+				p->crossfade = fade;
+				p->values.resize(std::min<uint64_t>(journaled, p->values.size()));
+				p->frames.resize(has_frames ? p->values.size() : 0);
+				in.read(p->values, count);
+				if (has_frames) in.read(p->frames, count);
+				if (in.is_valid && !p->values.empty() && p->values.size() == journaled + count) commit(*p);
+				pending.erase(pending.begin() + (p - pending.data()));
+				break;
+			}
+			case JOURNAL_MOVE: {
+				int time = in.read<int32_t>();
+				int duration = in.read<int32_t>();
+				if (!in.is_valid) return;
+				e->time = time;
+				e->duration = duration;
+				e->invalidate();
+				break;
+			}
+			case JOURNAL_FILTER: {
+				FilterSettings settings;
+				settings.type = (FilterType)in.read<uint32_t>();
+				settings.cutoff = in.read<float>();
+				settings.order = in.read<int32_t>();
+				settings.half_window = in.read<int32_t>();
+				settings.degree = in.read<int32_t>();
+				settings.min_cutoff = in.read<float>();
+				settings.beta = in.read<float>();
+				settings.d_cutoff = in.read<float>();
+				settings.rate = in.read<float>();
+				if (in.is_valid) filter(std::vector<Event*>{ e }, settings);
+				break;
+			}
+			case JOURNAL_CLEAR:
+				e->clear();
+				if (p) pending.erase(pending.begin() + (p - pending.data()));
+				break;
+			case JOURNAL_INTERPOLATE: {
+				uint32_t mode = in.read<uint32_t>();
+				if (in.is_valid) e->interpolation = (Interpolation)std::min(mode, (uint32_t)INTERPOLATION_BSPLINE);
+				break;
+			}
+			case JOURNAL_KEYS: {
+				int time = in.read<int32_t>();
+				int duration = in.read<int32_t>();
+				uint32_t mode = in.read<uint32_t>();
+				uint64_t count = in.read<uint64_t>();
+				bool has_times = in.read<uint8_t>();
+				std::vector<float> values, times;
+				in.read(values, count);
+				if (has_times) in.read(times, count);
+				if (!in.is_valid) return;
+				e->time = time;
+				e->duration = duration;
+				e->interpolation = (Interpolation)std::min(mode, (uint32_t)INTERPOLATION_BSPLINE);
+				e->keyframes.assign(std::move(values), has_times ? Keyframes::column(std::move(times)) : nullptr);
+				e->playhead = 0;
+				e->edited();
+				break;
+			}
+			case JOURNAL_SPLICE: {
+				int time = in.read<int32_t>();
+				int duration = in.read<int32_t>();
+				uint32_t mode = in.read<uint32_t>();
+				uint64_t from = in.read<uint64_t>();
+				uint64_t to = in.read<uint64_t>();
+				uint64_t count = in.read<uint64_t>();
+				bool has_times = in.read<uint8_t>();
+				std::vector<float> values, times;
+				in.read(values, count);
+				if (has_times) in.read(times, count);
+				// The keys must be those the splice was made on
+				if (!in.is_valid || from > to || to > e->keyframes.size() || has_times == e->keyframes.uniform()) return;
+				e->time = time;
+				e->duration = duration;
+				e->interpolation = (Interpolation)std::min(mode, (uint32_t)INTERPOLATION_BSPLINE);
+				if (to > from || count > 0) e->keyframes.splice(from, to, values.data(), times.data(), count);
+				e->playhead = 0;
+				e->edited();
+				break;
+			}
+			}
+		});
+		for (Pending& p : pending) {
+			if (!p.values.empty()) commit(p);
+		}
+		index.dirty = true;
+		updateRecordingTracks();
+		// The recovered session isn't an undoable edit
+		checkpoint(false);
+		if (!is_replayed && fs::exists(path)) {
+			std::cout << path << " is not a journal" << std::endl;
+			return false;
+		}
+
+		// Compaction: the replayed state becomes the only content of the journal
+		std::string temporary = path + ".tmp";
+		std::error_code error;
+		fs::remove(temporary, error);
+		journal = std::make_unique<Journal>(temporary);
+		for (const Track& t : tracks) {
+			for (const Event& e : t.events) {
+				if (!e.keyframes.empty()) journalKeys(e);
+			}
+		}
+		bool is_open = journal->isOpen();
+		journal.reset();
+		if (is_open) fs::rename(temporary, path, error);
+		if (!is_open || error) {
+			std::cout << "Could not compact " << path << std::endl;
+			return false;
+		}
+		journal = std::make_unique<Journal>(path);
+		return journal->isOpen();
+	}
+}
@@ -0,0 +1,76 @@
+#include "VRaFPipeline.h"
+#include "VRaFSequencer.h"
+
+namespace VRaF {
+
+	FramePipeline::FramePipeline(const Sequencer* sequencer, int from, int to, int n_workers, int lookahead)
+		: sequencer(sequencer), from(from), to(to), scheduled(from), consumed(from)
+	{
+		if (n_workers <= 0) n_workers = std::max(1u, std::thread::hardware_concurrency());
+		if (lookahead <= 0) lookahead = n_workers * 2;
+		slots.resize(lookahead);
+		// Read once here, as the host owns the targets
+		held.resize(sequencer->channels());
+		for (const Track& t : sequencer->tracks) {
+			for (const Event& e : t.events) {
+				if (e.keyframes.empty()) held[e.channel] = *e.target;
+			}
+		}
+		for (int i = 0; i < n_workers; i++) {
+			workers.emplace_back(&FramePipeline::work, this);
+		}
+	}
+
+	FramePipeline::~FramePipeline()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		cv.notify_all();
+		for (std::thread& t : workers) t.join();
+	}
+
+	std::shared_ptr<const FrameSnapshot> FramePipeline::next()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (consumed > to) return nullptr;
+		auto& slot = slots[(consumed - from) % slots.size()];
+		cv.wait(lock, [&] { return slot != nullptr; });
+		std::shared_ptr<const FrameSnapshot> result = std::move(slot);
+		slot = nullptr;
+		consumed++;
+		lock.unlock();
+		// A slot became free, let the workers run further ahead
+		cv.notify_all();
+		return result;
+	}
+
+	void FramePipeline::work()
+	{
+		int n_channels = sequencer->channels();
+		while (true) {
+			int frame;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				cv.wait(lock, [&] {
+					return stopping || scheduled > to || scheduled < consumed + (int)slots.size();
+				});
+				if (stopping || scheduled > to) return;
+				frame = scheduled++;
+			}
+
+			auto snapshot = std::make_shared<FrameSnapshot>();
+			snapshot->frame = frame;
+			snapshot->values.resize(n_channels);
+			double time = frame;
+			sequencer->evaluate(&time, 1, snapshot->values.data(), held.data());
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				slots[(frame - from) % slots.size()] = std::move(snapshot);
+			}
+			cv.notify_all();
+		}
+	}
+}
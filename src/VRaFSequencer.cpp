@@ -1,6 +1,8 @@
 #include "VRaFSequencer.h"
+#include "VRaFFilter.h"
 #include <iostream>
 #include <string>
+#include <algorithm>
 #include <filesystem>
 namespace fs = std::filesystem;
 
@@ -196,10 +198,60 @@ namespace VRaF {
 			if (!track.is_expanded && ImGui::Button("e", ImVec2(0, Theme.trackHeight))) 
 				track.is_expanded = !track.is_expanded;
 			ImGui::SetCursorPos({ Theme.headerWidth - btn_width, cursor_y });
-			if (ImGui::Button("F", ImVec2(0, Theme.trackHeight))) {
-				for (Event& e : track.events) {
-					e.filter();
+			auto filterTrack = [&]() {
+				std::vector<Event*> events;
+				for (Event& e : track.events) events.push_back(&e);
+				filter(events, track.filter);
+			};
+			if (ImGui::Button("F", ImVec2(0, Theme.trackHeight))) filterTrack();
+			auto filterSettings = [](FilterSettings& settings) {
+				const char* types[] = { "Butterworth", "Savitzky-Golay", "One-Euro" };
+				ImGui::Combo("Filter", (int*)&settings.type, types, IM_ARRAYSIZE(types));
+				if (settings.type == FILTER_BUTTERWORTH) {
+					ImGui::SliderFloat("Cutoff", &settings.cutoff, 0.01f, 0.99f);
+					ImGui::SliderInt("Order", &settings.order, 1, MAX_SECTIONS * 2);
+				}
+				else if (settings.type == FILTER_SAVITZKY_GOLAY) {
+					ImGui::SliderInt("Half window", &settings.half_window, 1, MAX_HALF_WINDOW);
+					ImGui::SliderInt("Degree", &settings.degree, 0, 6);
+				}
+				else if (settings.type == FILTER_ONE_EURO) {
+					ImGui::SliderFloat("Min cutoff, Hz", &settings.min_cutoff, 0.01f, 10.0f);
+					ImGui::SliderFloat("Beta", &settings.beta, 0.0f, 1.0f);
+				}
+			};
+			if (ImGui::BeginPopupContextItem("##filter_settings")) {
+				ImGui::PushFont(labels);
+				filterSettings(track.filter);
+				if (ImGui::Button("Apply")) {
+					filterTrack();
+					ImGui::CloseCurrentPopup();
 				}
+				// Causal filter while recording; smoother settings add latency
+				ImGui::Separator();
+				ImGui::Checkbox("Filter while recording", &track.live_filter);
+				if (track.live_filter) {
+					ImGui::PushID("live");
+					filterSettings(track.live);
+					ImGui::PopID();
+				}
+				// Change-driven recording
+				ImGui::DragFloat("Deadband", &track.deadband, 0.001f, 0.0f, 100.0f, "%.3f");
+				if (track.deadband > 0) ImGui::SliderInt("Max gap, frames", &track.max_gap, 0, 300);
+				ImGui::SliderInt("Crossfade, frames", &track.crossfade, 0, 60);
+				ImGui::Separator();
+				ImGui::DragFloat("Simplify tolerance", &track.tolerance, 0.001f, 0.0f, 100.0f, "%.3f");
+				if (ImGui::Button("Simplify")) {
+					simplify(track.label, track.tolerance);
+					ImGui::CloseCurrentPopup();
+				}
+				ImGui::DragFloat("Spline smoothing", &track.smoothing, 0.1f, 0.0f, 1000.0f, "%.1f");
+				if (ImGui::Button("Fit spline")) {
+					fit(track.label, track.smoothing);
+					ImGui::CloseCurrentPopup();
+				}
+				ImGui::PopFont();
+				ImGui::EndPopup();
 			}
 			ImGui::SetCursorPos({ Theme.headerWidth - btn_width * 2, cursor_y });
 			if (ImGui::Button("R", ImVec2(0, Theme.trackHeight))) {
@@ -210,9 +262,13 @@ namespace VRaF {
 			ImGui::SetCursorPos({ Theme.headerWidth - btn_width * 3, cursor_y });
 			if (ImGui::Button("C", ImVec2(0, Theme.trackHeight))) {
 				for (Event& e : track.events) {
+					if (journal) journal->append(journalRecord(JOURNAL_CLEAR, e));
 					e.clear();
+					moved(e);
 				}
 				track.recordings.clear();
+				updateRecordingTracks();
+				checkpoint();
 			}
 
 			ImGui::PopFont();
@@ -264,7 +320,7 @@ namespace VRaF {
 		 *                         |_________________________|
 		 *
 		 */
-		auto eventEditor = [&](const Event& event, ImVec2& cursor, int track_id, int event_id) {
+		auto eventEditor = [&](Event& event, ImVec2& cursor, int track_id, int event_id) {
 			float borderWidth = ImGui::GetStyle().PopupBorderSize;
 			const ImVec2 pos{ 
 				event.time * state.zoom.x + dims.C.x + state.pan.x + borderWidth,
@@ -307,6 +363,11 @@ namespace VRaF {
 			static float initial_time{ 0 };
 			static float initial_length{ 0 };
 			ImGui::PushID(track_id * 1000 + event_id);
+			// A held handle runs every frame; only actual moves are journaled
+			const int shown_time = event.time, shown_duration = event.duration;
+			auto drag = [&]() {
+				if (event.time != shown_time || event.duration != shown_duration) moved(event);
+			};
 
 			ImGui::SetCursorPos(head_pos - ImGui::GetWindowPos() - ImVec2(0, -ImGui::GetScrollY()));
 			//ImGui::SetItemAllowOverlap();
@@ -331,7 +392,9 @@ namespace VRaF {
 					event.time = state.range[0];
 					event.duration = initial_length + (initial_time - event.time);
 				}
+				drag();
 			}
+			if (ImGui::IsItemDeactivated()) checkpoint();
 
 			ImGui::SetCursorPos(tail_pos - ImGui::GetWindowPos() - ImVec2(0, -ImGui::GetScrollY()));
 			//ImGui::SetItemAllowOverlap();
@@ -347,7 +410,9 @@ namespace VRaF {
 				event.duration = initial_length + round(delta / state.zoom.x);
 				if (event.time + event.duration > state.range[1]) event.duration = state.range[1] - event.time;
 				if (event.duration < 1) event.duration = 1;
+				drag();
 			}
+			if (ImGui::IsItemDeactivated()) checkpoint();
 
 			ImGui::SetCursorPos(body_pos - ImGui::GetWindowPos() - ImVec2(0, -ImGui::GetScrollY()));
 			ImGui::SetItemAllowOverlap();
@@ -365,7 +430,9 @@ namespace VRaF {
 				event.time = initial_time + round(delta / state.zoom.x);
 				if (event.time < state.range[0]) event.time = state.range[0];
 				if (event.time + event.duration > state.range[1]) event.time = state.range[1] - event.duration;
+				drag();
 			}
+			if (ImGui::IsItemDeactivated()) checkpoint();
 
 			ImGui::PopID();
 
@@ -393,21 +460,41 @@ namespace VRaF {
 				ImGui::GetColorU32(ImGuiCol_Border, 1.0), borderWidth);
 			// Keyframes curve
 			if (event.keyframes.size() > 0) {
-				float keymax = 0, keymin = 9999;
-				for (const std::pair<float, float>& key : event.keyframes) {
-					if (key.second > keymax) keymax = key.second;
-					if (key.second < keymin) keymin = key.second;
+				const Keyframes& keys = event.keyframes;
+				if (event.pyramid.empty()) event.pyramid.build(keys);
+				float keymin, keymax;
+				event.pyramid.range(keys, 0, keys.size(), keymin, keymax);
+				float scale = keymax > keymin ? size.y / (keymax - keymin) : 0;
+				ImVec2 origin = pos - ImVec2(borderWidth, 0);
+				auto point = [&](float x, float value) { return origin + ImVec2(x, size.y - (value - keymin) * scale); };
+
+				// Only the visible part of the event, in pixels from its start
+				float width = event.duration * state.zoom.x;
+				float x_from = std::max(0.0f, dims.C.x - origin.x);
+				float x_to = std::min(width, dims.C.x + dims.windowSize.x - origin.x);
+				size_t first = keys.lower_bound(x_from / width);
+				size_t last = keys.lower_bound(x_to / width);
+				// One more key on each side, so the line reaches the edges
+				if (first > 0) first--;
+				if (last < keys.size()) last++;
+
+				curve.clear();
+				if (last - first <= 2 * (x_to - x_from)) {
+					for (size_t i = first; i < last; i++) curve.push_back(point(width * keys.time(i), keys.value(i)));
 				}
-				float scale = size.y / (keymax - keymin);
-				ImVec2 last_point(0, size.y - (event.keyframes[0].second - keymin) * scale);
-				for (const std::pair<float, float>& key : event.keyframes) {
-					ImVec2 curr_point(event.duration * key.first * state.zoom.x, size.y - (key.second - keymin) * scale);
-					painter->AddLine(
-						pos - ImVec2(borderWidth, 0) + last_point, 
-						pos - ImVec2(borderWidth, 0) + curr_point,
-						ImGui::GetColorU32(ImGuiCol_ButtonHovered, 1.0));
-					last_point = curr_point;
+				else {
+					// Denser than the pixels: min and max of each pixel column
+					for (float x = floor(x_from); x < x_to; x += 1) {
+						size_t from = keys.lower_bound(x / width);
+						size_t to = keys.lower_bound((x + 1) / width);
+						if (from >= to) continue;
+						float lo, hi;
+						event.pyramid.range(keys, from, to, lo, hi);
+						curve.push_back(point(x + 0.5f, lo));
+						curve.push_back(point(x + 0.5f, hi));
+					}
 				}
+				painter->AddPolyline(curve.data(), curve.size(), ImGui::GetColorU32(ImGuiCol_ButtonHovered, 1.0), 0, 1.0f);
 			}
 
 			if (head_hovered)
@@ -429,35 +516,47 @@ namespace VRaF {
 			}
 		};
 
-		ImVec2 cursor(dims.C.x + state.pan.x, dims.C.y);
-		int event_id = 0, track_id = 0;
-		if (section == SECTION_LISTER) {
-			cursor = { dims.X.x, dims.C.y };
-			event_id = track_id = 0;
-			for (Track& track : tracks) {
+		/**
+		 * Rows are Theme.trackHeight tall: the track, then its events if expanded.
+		 * Only the rows in view submit anything; rows[i] is the first row of track i
+		 */
+		rows.resize(tracks.size() + 1);
+		rows[0] = 0;
+		for (size_t i = 0; i < tracks.size(); i++) {
+			rows[i + 1] = rows[i] + 1 + (tracks[i].is_expanded ? tracks[i].events.size() : 0);
+		}
+		float scroll = ImGui::GetScrollY();
+		int first_row = (int)(scroll / Theme.trackHeight);
+		int last_row = (int)((scroll + dims.windowSize.y) / Theme.trackHeight) + 1;
+		int first_track = std::upper_bound(rows.begin(), rows.end(), first_row) - rows.begin() - 1;
+
+		for (int track_id = std::max(first_track, 0); track_id < (int)tracks.size(); track_id++) {
+			if (rows[track_id] > last_row) break;
+			Track& track = tracks[track_id];
+			float y = dims.C.y + rows[track_id] * Theme.trackHeight;
+			if (section == SECTION_LISTER) {
+				ImVec2 cursor(dims.X.x, y);
 				trackHeader(track, cursor, track_id);
-				if (track.is_expanded) {
-					for (Event& e : track.events) {
-						cursor.y += Theme.trackHeight;
-						event_id++;
-					}
-				}
-				track_id++;
 			}
-		}
-		else if (section == SECTION_EDITOR) {
-			ImVec2 cursor(dims.C.x + state.pan.x, dims.C.y);
-			int event_id = 0, track_id = 0;
-			for (Track& track : tracks) {
+			else if (section == SECTION_EDITOR) {
+				ImVec2 cursor(dims.C.x + state.pan.x, y);
 				trackEditor(track, cursor, track_id);
 				if (!track.is_expanded) continue;
-				for (Event& e : track.events) {
-					eventEditor(e, cursor, track_id, event_id);
-					event_id++;
+				for (int event_id = 0; event_id < (int)track.events.size(); event_id++) {
+					int row = rows[track_id] + 1 + event_id;
+					if (row > last_row) break;
+					if (row < first_row) {
+						cursor.y += Theme.trackHeight;
+						continue;
+					}
+					eventEditor(track.events[event_id], cursor, track_id, event_id);
 				}
-				track_id++;
 			}
 		}
+
+		// Reserve the height of the skipped rows, so that scrolling still works
+		ImGui::SetCursorPos(ImVec2(0, dims.C.y - ImGui::GetWindowPos().y + rows.back() * Theme.trackHeight - 1));
+		ImGui::Dummy(ImVec2(1, 1));
 	}
 
 	void Sequencer::drawGrid(SectionType section) {
@@ -703,8 +802,11 @@ namespace VRaF {
 
 		if (ImGui::IsKeyPressed(ImGuiKey_Space)) toggle();
 
-		// Navigation
 		ImGuiIO& io = ImGui::GetIO();
+		if (io.KeyCtrl && ImGui::IsKeyPressed(ImGuiKey_Z)) io.KeyShift ? redo() : undo();
+		if (io.KeyCtrl && ImGui::IsKeyPressed(ImGuiKey_Y)) redo();
+
+		// Navigation
 		if (io.WantCaptureMouse && ImGui::IsWindowHovered()) {
 			if (io.MouseWheel != 0 && io.MousePos.x > dims.C.x) {
 				float zoom_upd = state.zoom.x + io.MouseWheel;
@@ -729,6 +831,8 @@ namespace VRaF {
 	void Sequencer::update(float time)
 	{
 		state.currTime = time;
+		if (sampler) sampler->sync(time);
+		drainRings();
 		if (state.isPlaying) {
 			int frame = state.frame;
 			if (state.frame < state.range[0]) state.frame = state.range[0];
@@ -736,30 +840,356 @@ namespace VRaF {
 				state.startTime = state.currTime;
 				stop_recording();
 			}
-			state.frame = (state.currTime - state.startTime) * fps + state.range[0];
+			double time = (state.currTime - state.startTime) * fps + state.range[0];
+			state.frame = time;
 			if (state.frame != frame) {
-				updateEvents(frame);
+				updateEvents(state.frame);
 			}
+			updateInterpolated(time);
+			commit(time);
 		}
+		if (journal) journalSamples();
 	}
 
 	void Sequencer::updateEvents() {
 		updateEvents(state.frame);
+		commit(state.frame);
 	}
 
 	void Sequencer::updateEvents(int frame) {
-		for (Track& track : tracks) {
-			for (Event& e : track.events) {
-				if (e.time <= frame && e.time + e.duration >= frame) {
-					e.update(frame);
+		for (Event* e : activeEvents(frame)) {
+			// Punch-in: a target being recorded isn't played back
+			if (!recording_tracks.empty() && isRecorded(e->target)) continue;
+			if (e->kernel) {
+				if (e->component == 0) updateChannels(e, frame);
+				continue;
+			}
+			if (baking) {
+				int from = std::max(e->time, state.range[0]);
+				int to = std::min(e->time + e->duration, state.range[1]);
+				if (frame >= from && frame <= to) {
+					if (!e->isBaked(from, to)) e->bake(from, to);
+					write(*e, e->baked[frame - e->bakedFrom]);
+					continue;
+				}
+			}
+			write(*e, e->value(frame));
+		}
+		for (size_t t : recording_tracks) {
+			for (Recording& r : tracks[t].recordings) {
+				if (!r.ring) r.update(frame);
+			}
+		}
+	}
+
+	const std::vector<Event*>& Sequencer::activeEvents(int frame) {
+		if (index.dirty) index.rebuild(tracks);
+		index.query(frame, active);
+		return active;
+	}
+
+	void Sequencer::moved(Event& event) {
+		history.is_dirty = true;
+		event.invalidate();
+		index.update(&event);
+		if (journal) journal->append(journalRecord(JOURNAL_MOVE, event) << event.time << event.duration);
+	}
+
+	void Sequencer::updateRecordingTracks() {
+		recording_tracks.clear();
+		host_channels.clear();
+		for (size_t t = 0; t < tracks.size(); t++) {
+			if (!tracks[t].recordings.empty()) recording_tracks.push_back(t);
+			for (const Event& e : tracks[t].events) {
+				if (e.keyframes.empty() || isRecorded(e.target)) host_channels.push_back(&e);
+			}
+		}
+	}
+
+	void EventIndex::rebuild(std::vector<Track>& tracks)
+	{
+		entries.clear();
+		for (Track& t : tracks) {
+			for (Event& e : t.events) {
+				if (!e.keyframes.empty()) entries.push_back({ e.time, e.time + e.duration + 1, 0, &e });
+			}
+		}
+		std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.start < b.start; });
+		prepare();
+		dirty = false;
+	}
+
+	void EventIndex::update(Event* event)
+	{
+		if (dirty) return;
+		auto it = std::find_if(entries.begin(), entries.end(), [&](const Entry& x) { return x.event == event; });
+		if (it == entries.end() || event->keyframes.empty()) {
+			dirty = true;
+			return;
+		}
+		it->start = event->time;
+		it->end = event->time + event->duration + 1;
+		// Only this entry may be out of order
+		while (it != entries.begin() && (it - 1)->start > it->start) {
+			std::iter_swap(it - 1, it);
+			--it;
+		}
+		while (it + 1 != entries.end() && (it + 1)->start < it->start) {
+			std::iter_swap(it + 1, it);
+			++it;
+		}
+		prepare();
+	}
+
+	void EventIndex::prepare()
+	{
+		// Node i at level k has its k lowest bits set and bit k clear;
+		// its children are i -/+ 2^(k-1). Leaves are the even indices
+		int n = entries.size();
+		root_level = -1;
+		if (n == 0) return;
+		int last_i = 0, last = 0;
+		for (int i = 0; i < n; i += 2) {
+			last_i = i;
+			last = entries[i].max = entries[i].end;
+		}
+		int k = 1;
+		for (; 1 << k <= n; k++) {
+			int x = 1 << (k - 1), i0 = (x << 1) - 1, step = x << 2;
+			for (int i = i0; i < n; i += step) {
+				int left = entries[i - x].max;
+				// A missing right subtree is covered by the rightmost node of the level
+				int right = i + x < n ? entries[i + x].max : last;
+				entries[i].max = std::max({ entries[i].end, left, right });
+			}
+			last_i = (last_i >> k & 1) ? last_i - x : last_i + x;
+			if (last_i < n && entries[last_i].max > last) last = entries[last_i].max;
+		}
+		root_level = k - 1;
+	}
+
+	void EventIndex::query(int frame, std::vector<Event*>& out) const
+	{
+		out.clear();
+		if (root_level < 0) return;
+		int n = entries.size();
+		int start = frame, end = frame + 1;
+		struct Node { int level, i; bool left_done; };
+		Node stack[64];
+		int top = 0;
+		stack[top++] = { root_level, (1 << root_level) - 1, false };
+		while (top) {
+			Node z = stack[--top];
+			if (z.level <= 3) {
+				// Small subtree: scan it
+				int i0 = z.i >> z.level << z.level;
+				int i1 = std::min(i0 + (1 << (z.level + 1)) - 1, n);
+				for (int i = i0; i < i1 && entries[i].start < end; i++) {
+					if (start < entries[i].end) out.push_back(entries[i].event);
+				}
+			}
+			else if (!z.left_done) {
+				int left = z.i - (1 << (z.level - 1));
+				stack[top++] = { z.level, z.i, true };
+				if (left >= n || entries[left].max > start) stack[top++] = { z.level - 1, left, false };
+			}
+			else if (z.i < n && entries[z.i].start < end) {
+				if (start < entries[z.i].end) out.push_back(entries[z.i].event);
+				stack[top++] = { z.level - 1, z.i + (1 << (z.level - 1)), false };
+			}
+		}
+	}
+
+	void Sequencer::evaluate(double time) {
+		for (Event* e : activeEvents((int)floor(time))) {
+			if (e->time <= time && e->time + e->duration >= time) {
+				if (!e->kernel) write(*e, e->value(time));
+				else if (e->component == 0) updateChannels(e, time);
+			}
+		}
+		commit(time);
+	}
+
+	void Sequencer::updateChannels(const Event* first, double frame) {
+		float values[MAX_COMPONENTS];
+		first->kernel->evaluate(first, frame, nullptr, values);
+		for (int c = 0; c < first->kernel->components; c++) write(first[c], values[c]);
+	}
+
+	void Sequencer::write(const Event& event, float value) {
+		if (writing_targets) *event.target = value;
+		outputs[event.channel] = value;
+		written[event.channel] = version + 1;
+	}
+
+	void Sequencer::commit(double frame) {
+		// Channels that weren't played back keep their last value, unless
+		// the host owns it
+		for (const Event* e : host_channels) {
+			if (written[e->channel] <= version) outputs[e->channel] = *e->target;
+		}
+		version++;
+		output_frame = frame;
+		std::erase_if(publishers, [](const std::shared_ptr<SnapshotBuffer>& p) { return p.use_count() == 1; });
+		for (auto& p : publishers) p->publish(version, frame, outputs.data(), outputs.size());
+		if (shared) shared->publish(version, frame, outputs.data(), outputs.size());
+		if (frame_callback) frame_callback(output());
+	}
+
+	FrameOutput Sequencer::output() const {
+		return { version, output_frame, outputs.data(), (int)outputs.size() };
+	}
+
+	void Sequencer::onFrame(std::function<void(const FrameOutput&)> callback) {
+		frame_callback = std::move(callback);
+	}
+
+	void Sequencer::writeTargets(bool enable) {
+		writing_targets = enable;
+	}
+
+	std::shared_ptr<SnapshotBuffer> Sequencer::snapshots() {
+		publishers.push_back(std::make_shared<SnapshotBuffer>());
+		return publishers.back();
+	}
+
+	bool Sequencer::share(std::string name, int slots) {
+		shared.reset();
+		if (name.empty()) return true;
+		std::vector<SharedTrackInfo> infos;
+		for (const Track& t : tracks) infos.push_back({ t.label, t.events[0].channel, (int)t.events.size() });
+		shared = SharedFramePublisher::create(name, fps, infos, std::max(slots, 1));
+		if (!shared) std::cout << "Could not create shared memory " << name << std::endl;
+		return shared != nullptr;
+	}
+
+	int Sequencer::channels() const {
+		int n = 0;
+		for (const Track& track : tracks) n += track.events.size();
+		return n;
+	}
+
+	void Sequencer::evaluate(const double* times, int count, float* out) const {
+		evaluate(times, count, out, nullptr);
+	}
+
+	void Sequencer::evaluate(const double* times, int count, float* out, const float* held) const {
+		std::vector<const Event*> pending;
+		for (const Track& track : tracks) {
+			const Event* first = track.events.data();
+			if (track.kernel && !first->keyframes.empty()) {
+				track.kernel->evaluateTimes(first, times, count, out + first->channel * count);
+				continue;
+			}
+			for (const Event& e : track.events) {
+				float* values = out + e.channel * count;
+				if (e.keyframes.empty()) {
+					std::fill(values, values + count, held ? held[e.channel] : *e.target);
+				}
+				else if (e.interpolation == INTERPOLATION_LINEAR || e.interpolation == INTERPOLATION_STEP) {
+					pending.push_back(&e);
 				}
+				else {
+					// Own cursor instead of the event playhead keeps this call const
+					size_t cursor = 0;
+					for (int i = 0; i < count; i++) {
+						double time = std::clamp(times[i], (double)e.time, (double)(e.time + e.duration));
+						values[i] = e.value(time, cursor);
+					}
+				}
+			}
+		}
+		// Channels with the same key times and chunks, e.g. the components of
+		// a vector, are evaluated together: the keys around each time are found
+		// once, then each channel is a single pass reading them
+		struct Lookup {
+			uint32_t chunks[2], offsets[2];  // Keys before and after the time
+			float weight;  // Of the key after; negative when there is no key before
+		};
+		std::vector<Lookup> lookups(pending.empty() ? 0 : count);
+		while (!pending.empty()) {
+			const Event* first = pending[0];
+			const Keyframes& k = first->keyframes;
+			auto isSame = [&](const Event* e) {
+				return e->time == first->time && e->duration == first->duration && e->interpolation == first->interpolation
+					&& e->keyframes.sameTimes(k) && e->keyframes.starts == k.starts;
+			};
+			size_t n = k.size(), cursor = 0;
+			bool is_step = first->interpolation == INTERPOLATION_STEP || n < 2;
+			auto at = [&](Lookup& l, int side, size_t key) {
+				l.chunks[side] = (uint32_t)k.locate(key);
+				l.offsets[side] = (uint32_t)(key - k.chunkStart(l.chunks[side]));
+			};
+			for (int i = 0; i < count; i++) {
+				double time = std::clamp(times[i], (double)first->time, (double)(first->time + first->duration));
+				float t = (float)((time - first->time) / first->duration);
+				size_t key = first->seek(t, cursor);
+				Lookup& l = lookups[i];
+				l.weight = 0;
+				if (key == 0 && is_step) l.weight = -1;
+				// Step holds the key before; linear holds the end keys
+				size_t before = key == 0 ? 0 : key - 1;
+				at(l, 0, before);
+				at(l, 1, before);
+				if (is_step || key == 0 || key == n) continue;
+				at(l, 1, key);
+				float dt = k.time(key) - k.time(key - 1);
+				l.weight = dt > 0 ? (t - k.time(key - 1)) / dt : 0;
 			}
-			for (Recording& r : track.recordings) {
-				r.update(frame);
+			for (const Event* e : pending) {
+				if (!isSame(e)) continue;
+				const Keyframes& v = e->keyframes;
+				float* values = out + e->channel * count;
+				for (int i = 0; i < count; i++) {
+					const Lookup& l = lookups[i];
+					float a = v.chunk(l.chunks[0])[l.offsets[0]];
+					float b = v.chunk(l.chunks[1])[l.offsets[1]];
+					values[i] = l.weight < 0 ? 0 : a + (b - a) * l.weight;
+				}
 			}
+			std::erase_if(pending, isSame);
+		}
+	}
+
+	void Sequencer::evaluate(const int* frames, int count, float* out) const {
+		std::vector<double> times(frames, frames + count);
+		evaluate(times.data(), count, out);
+	}
+
+	int Sequencer::channel(std::string label) const {
+		int n = 0;
+		for (const Track& track : tracks) {
+			if (track.label == label) return n;
+			n += track.events.size();
+		}
+		return -1;
+	}
+
+	FramePipeline Sequencer::frames(int workers, int lookahead) const {
+		return FramePipeline(this, state.range[0], state.range[1], workers, lookahead);
+	}
+
+	void Sequencer::updateInterpolated(double time) {
+		// Called every host frame during playback, so that interpolated
+		// events move smoothly when the host runs faster than fps
+		for (Event* e : activeEvents((int)floor(time))) {
+			if (e->interpolation == INTERPOLATION_STEP) continue;
+			if (e->time > time || e->time + e->duration < time) continue;
+			if (isRecorded(e->target)) continue;
+			if (!e->kernel) write(*e, e->value(time));
+			else if (e->component == 0) updateChannels(e, time);
 		}
 	}
 
+	bool Sequencer::isRecorded(const float* target) const {
+		for (size_t t : recording_tracks) {
+			for (const Recording& r : tracks[t].recordings) {
+				if (r.target == target) return true;
+			}
+		}
+		return false;
+	}
+
 	void Sequencer::record(float* target)
 	{
 		// Check if the target is being recorded
@@ -770,69 +1200,301 @@ namespace VRaF {
 			}
 			for (Event& e : t.events) {
 				if (e.target == target) {
+					FilterSettings live = t.live;
+					live.rate = fps;
 					t.recordings.push_back({
-						.target = target
+						.target = target,
+						.ring = capturing ? e.ring : nullptr,
+						// Components evaluated together must keep their keys aligned
+						.deadband = t.kernel ? 0 : t.deadband,
+						.max_gap = t.max_gap,
+						.is_extrapolated = e.interpolation != INTERPOLATION_STEP,
+						.is_filtered = t.live_filter,
+						.filter = LiveFilter(live)
 						});
+					if (t.recordings.back().deadband <= 0) t.recordings.back().values.reserve(state.range[1] - state.range[0] + 1);
+					if (!t.kernel) continue;
+					// Components evaluated together are recorded together
+					for (Event& other : t.events) {
+						if (other.target != target) record(other.target);
+					}
 				}
 			}
 		}
+		updateRecordingTracks();
 	}
 
 	void Sequencer::stop_recording()
 	{
+		drainRings();
 		// Transform all the recordings into events
 		for (Track& t : tracks) {
+			std::vector<Event*> recorded;
+			int first = INT_MAX, last = INT_MIN;  // Recorded frames
+			for (Recording& r : t.recordings) r.finish();
+			int fade = t.crossfade;
+			if (t.kernel && fade > 0) {
+				crossfade(t);
+				fade = 0;
+			}
 			for (Recording& r : t.recordings) {
-				int time = r.keyframes[0].first;
-				int duration = r.keyframes[r.keyframes.size() - 1].first - time;
-				std::vector<std::pair<float, float>> event_frames;
+				if (r.values.empty()) continue;
+				first = std::min(first, r.start);
+				last = std::max(last, r.frames.empty() ? r.start + (int)r.values.size() - 1 : r.frames.back());
 				for (Event& e : t.events) {
 					if (e.target == r.target) {
-						// TODO: Overwrite only the section captured by the recording
-						e.keyframes.clear();
-						e.time = time;
-						e.duration = duration;
-						for (std::pair<int, float> frame : r.keyframes) {
-							e.keyframes.push_back({ (float)(frame.first - time) / duration, frame.second });
+						if (journal) {
+							JournalRecord record = journalRecord(JOURNAL_COMMIT, e);
+							size_t count = r.values.size() - r.journaled;
+							record << (int32_t)r.start << (uint64_t)r.journaled << (uint64_t)count << (uint8_t)!r.frames.empty()
+								<< (int32_t)fade;
+							record.write(r.values.data() + r.journaled, count);
+							if (!r.frames.empty()) record.write(r.frames.data() + r.journaled, count);
+							journal->append(record);
 						}
+						e.splice(r.start, std::move(r.values), r.frames, fade);
+						moved(e);
+						recorded.push_back(&e);
+						break;
 					}
 				}
-
 			}
+			// Components spliced alike share their time column again
+			for (size_t i = 1; i < recorded.size(); i++) {
+				for (size_t j = 0; j < i; j++) {
+					Keyframes& a = recorded[i]->keyframes;
+					const Keyframes& b = recorded[j]->keyframes;
+					if (a.sameTimes(b) || a.shareTimes(b)) break;
+				}
+			}
+			if (t.tolerance > 0) simplify(recorded, t.tolerance, first, last);
 			t.recordings.clear();
 		}
+		updateRecordingTracks();
+		checkpoint();
 	}
 
-	void Sequencer::track(std::string label, glm::vec2* value)
+	void Sequencer::crossfade(Track& t)
 	{
-		tracks.push_back({
-			.events = { { 0, 0, {}, &(value->x) }, { 0, 0, {}, &(value->y) }},
-			.label = label }
-		);
+		// The components blend into the old values together, before splicing
+		const Event* first = t.events.data();
+		std::vector<Recording*> components;
+		for (const Event& e : t.events) {
+			auto r = std::find_if(t.recordings.begin(), t.recordings.end(), [&](const Recording& r) { return r.target == e.target; });
+			if (r == t.recordings.end() || !r->frames.empty() || r->values.empty()) return;
+			components.push_back(&*r);
+		}
+		int start = components[0]->start;
+		size_t n = components[0]->values.size();
+		for (Recording* r : components) {
+			if (r->start != start || r->values.size() != n) return;
+		}
+		if (first->keyframes.empty()) return;
+		float old_values[MAX_COMPONENTS], recorded[MAX_COMPONENTS], blended[MAX_COMPONENTS];
+		for (size_t i = 0; i < n; i++) {
+			// Only the first and last crossfade frames
+			if (i == (size_t)t.crossfade && n > 2 * i) i = n - i;
+			int frame = start + (int)i;
+			float w = (float)(std::min(i, n - 1 - i) + 1) / (t.crossfade + 1);
+			if (w >= 1 || frame < first->time || frame > first->time + first->duration) continue;
+			t.kernel->evaluate(first, frame, nullptr, old_values);
+			for (size_t c = 0; c < components.size(); c++) recorded[c] = components[c]->values[i];
+			t.kernel->blend(old_values, recorded, w, blended);
+			for (size_t c = 0; c < components.size(); c++) components[c]->values[i] = blended[c];
+		}
+		// The journal gets the blended values in the commit
+		for (Recording* r : components) r->journaled = 0;
 	}
 
-	void Sequencer::track(std::string label, glm::vec3* value)
+	void Sequencer::capture(bool enable, int rate)
 	{
-		tracks.push_back({
-			.events = { { 0, 0, {}, &(value->x) }, { 0, 0, {}, &(value->y) }, { 0, 0, {}, &(value->z) }},
-			.label = label }
-		);
+		// Samples captured so far still go to the recordings
+		drainRings();
+		capturing = enable;
+		sampler.reset();
+		for (Track& t : tracks) {
+			for (Event& e : t.events) {
+				e.ring.reset();
+				e.sampled = nullptr;
+			}
+		}
+		if (enable && rate > 0) sampler = std::make_unique<Sampler>(rate);
+		// With a sampler, a target gets its ring once the host feeds it, see sampled()
+		else if (enable) {
+			for (Track& t : tracks) {
+				for (Event& e : t.events) ring(e.target);
+			}
+		}
+		connectRings();
+	}
+
+	void Sequencer::connectRings()
+	{
+		// Recordings in progress go on with the current rings, or read their
+		// targets once per update() again without them
+		for (Track& t : tracks) {
+			for (Recording& r : t.recordings) {
+				for (const Event& e : t.events) {
+					if (e.target == r.target) r.ring = e.ring;
+				}
+			}
+		}
+	}
+
+	std::shared_ptr<SampleRing> Sequencer::ring(float* target)
+	{
+		for (Track& t : tracks) {
+			for (Event& e : t.events) {
+				if (e.target != target) continue;
+				if (!e.ring && capturing && !sampler) e.ring = std::make_shared<SampleRing>();
+				return e.ring;
+			}
+		}
+		return nullptr;
+	}
+
+	std::atomic<float>* Sequencer::sampled(float* target)
+	{
+		for (Track& t : tracks) {
+			for (Event& e : t.events) {
+				if (e.target != target || !sampler) continue;
+				if (!e.sampled) {
+					e.ring = std::make_shared<SampleRing>();
+					e.sampled = sampler->add(*target, e.ring);
+					connectRings();
+				}
+				return e.sampled;
+			}
+		}
+		return nullptr;
+	}
+
+	void Sequencer::drainRings()
+	{
+		for (Track& t : tracks) {
+			for (Event& e : t.events) {
+				if (!e.ring) continue;
+				Recording* recording = 0;
+				for (Recording& r : t.recordings) {
+					if (r.ring == e.ring) recording = &r;
+				}
+				// Samples that arrive while not recording are dropped
+				Sample sample;
+				while (e.ring->pop(sample)) {
+					if (!recording || !state.isPlaying) continue;
+					int frame = (int)round((sample.time - state.startTime) * fps) + state.range[0];
+					if (frame >= state.range[0] && frame <= state.range[1]) recording->add(frame, sample.value);
+				}
+			}
+		}
+	}
+
+	void Sequencer::filter(std::string label)
+	{
+		for (Track& t : tracks) {
+			if (t.label != label) continue;
+			std::vector<Event*> events;
+			for (Event& e : t.events) events.push_back(&e);
+			filter(events, t.filter);
+		}
+		checkpoint();
+	}
+
+	void Sequencer::filter(std::string label, const FilterSettings& settings)
+	{
+		for (Track& t : tracks) {
+			if (t.label == label) t.filter = settings;
+		}
+		filter(label);
+	}
+
+	void Sequencer::filter()
+	{
+		// Tracks sharing the settings are filtered in one go
+		std::vector<Track*> pending;
+		for (Track& t : tracks) pending.push_back(&t);
+		while (!pending.empty()) {
+			FilterSettings settings = pending[0]->filter;
+			std::vector<Event*> events;
+			for (Track* t : pending) {
+				if (!(t->filter == settings)) continue;
+				for (Event& e : t->events) events.push_back(&e);
+			}
+			filter(events, settings);
+			std::erase_if(pending, [&](Track* t) { return t->filter == settings; });
+		}
+		checkpoint();
+	}
+
+	void Sequencer::filter(const std::vector<Event*>& events, const FilterSettings& track_settings)
+	{
+		FilterSettings settings = track_settings;
+		settings.rate = fps;
+		// Channels of equal length are filtered together, which covers all
+		// the components of a track recorded at once
+		std::vector<Event*> pending(events);
+		std::erase_if(pending, [](Event* e) { return e->keyframes.empty(); });
+		while (!pending.empty()) {
+			size_t length = pending[0]->keyframes.size();
+			std::vector<Event*> group;
+			std::vector<std::vector<float>> values;
+			std::vector<float*> channels;
+			for (Event* e : pending) {
+				if (e->keyframes.size() != length) continue;
+				group.push_back(e);
+				values.push_back(e->keyframes.copy());
+				// Replaying a filter on one event can't encode the components of
+				// kernel tracks together, so those journal the filtered keys
+				if (!e->kernel) journalFilter(*e, settings);
+			}
+			for (std::vector<float>& v : values) channels.push_back(v.data());
+			// Components of non-separable types are filtered in their own domain
+			auto convert = [&](bool is_encoding) {
+				for (Event* e : group) {
+					if (!e->kernel || e->component != 0) continue;
+					std::vector<float*> components;
+					for (int c = 0; c < e->kernel->components; c++) {
+						auto found = std::find(group.begin(), group.end(), e + c);
+						if (found != group.end()) components.push_back(channels[found - group.begin()]);
+					}
+					if ((int)components.size() != e->kernel->components) continue;
+					if (is_encoding) e->kernel->encode(components.data(), length);
+					else e->kernel->decode(components.data(), length);
+				}
+			};
+			convert(true);
+			VRaF::filter(channels.data(), channels.size(), length, settings);
+			convert(false);
+			for (size_t i = 0; i < group.size(); i++) {
+				group[i]->keyframes.replace(values[i]);
+				group[i]->edited();
+				if (group[i]->kernel) journalKeys(*group[i]);
+			}
+			std::erase_if(pending, [&](Event* e) { return e->keyframes.size() == length; });
+		}
 	}
 
-	void Sequencer::track(std::string label, glm::vec4* value)
+	void Sequencer::interpolate(std::string label, Interpolation mode)
 	{
-		tracks.push_back({
-			.events = { { 0, 0, {}, &(value->x) }, { 0, 0, {}, &(value->y) }, { 0, 0, {}, &(value->z) }, { 0, 0, {}, &(value->w) }},
-			.label = label }
-		);
+		for (Track& t : tracks) {
+			if (t.label != label) continue;
+			for (Event& e : t.events) {
+				e.interpolation = mode;
+				e.invalidate();
+				if (journal) journal->append(journalRecord(JOURNAL_INTERPOLATE, e) << (uint32_t)mode);
+			}
+		}
+		checkpoint();
 	}
 
-	void Sequencer::track(std::string label, float* value)
+	void Sequencer::bake(bool enable)
 	{
-		tracks.push_back({
-			.events = { { 0, 0, {}, value }},
-			.label = label }
-		);
+		baking = enable;
+		if (baking) return;
+		// Release the arrays; they are rebuilt lazily when baking is enabled again
+		for (Track& t : tracks) {
+			for (Event& e : t.events) e.invalidate();
+		}
 	}
 
 	void Sequencer::toggle()
@@ -849,53 +1511,690 @@ namespace VRaF {
 
 	void Event::update(int frame)
 	{
-		float frameNorm = (float)(frame - time) / duration;
-		float value = 0;
-		for (auto& [t, v] : keyframes) {
-			if (t <= frameNorm) value = v;
+		*target = value(frame);
+	}
+
+	// Cubic Hermite segment between p0 and p1; tangents are per unit of t
+	static float hermite(float p0, float p1, float m0, float m1, float u, float dt)
+	{
+		float u2 = u * u, u3 = u2 * u;
+		return (2 * u3 - 3 * u2 + 1) * p0 + (u3 - 2 * u2 + u) * dt * m0
+			+ (-2 * u3 + 3 * u2) * p1 + (u3 - u2) * dt * m1;
+	}
+
+	float Event::value(double frame) const
+	{
+		return value(frame, playhead);
+	}
+
+	float Event::value(double frame, size_t& cursor) const
+	{
+		float frameNorm = (float)((frame - time) / duration);
+		const Keyframes& k = keyframes;
+		size_t n = k.size();
+		if (interpolation == INTERPOLATION_BSPLINE && n >= 4) {
+			// Control points on uniform knots: the segment is known without a search
+			size_t segments = n - 3;
+			float u = (frameNorm > 0 ? std::min(frameNorm, 1.0f) : 0.0f) * segments;
+			size_t i = std::min((size_t)u, segments - 1);
+			float w[4];
+			bsplineBasis(u - i, w);
+			return w[0] * k.value(i) + w[1] * k.value(i + 1) + w[2] * k.value(i + 2) + w[3] * k.value(i + 3);
+		}
+		size_t key = seek(frameNorm, cursor);
+		if (interpolation == INTERPOLATION_STEP || n < 2) {
+			return key > 0 ? k.value(key - 1) : 0;
+		}
+		if (key == 0) return k.value(0);
+		if (key == n) return k.value(n - 1);
+
+		// Segment [i, j] contains frameNorm
+		size_t i = key - 1, j = key;
+		float t0 = k.time(i), p0 = k.value(i);
+		float t1 = k.time(j), p1 = k.value(j);
+		float dt = t1 - t0;
+		float u = dt > 0 ? (frameNorm - t0) / dt : 0;
+		if (interpolation == INTERPOLATION_LINEAR) return p0 + (p1 - p0) * u;
+
+		float d = dt > 0 ? (p1 - p0) / dt : 0;
+		float d_prev = d, d_next = d;
+		if (i > 0 && t0 > k.time(i - 1)) {
+			d_prev = (p0 - k.value(i - 1)) / (t0 - k.time(i - 1));
+		}
+		if (j + 1 < n && k.time(j + 1) > t1) {
+			d_next = (k.value(j + 1) - p1) / (k.time(j + 1) - t1);
+		}
+
+		float m0, m1;
+		if (interpolation == INTERPOLATION_CATMULL_ROM) {
+			m0 = i > 0 ? (p1 - k.value(i - 1)) / (t1 - k.time(i - 1)) : d;
+			m1 = j + 1 < n ? (k.value(j + 1) - p0) / (k.time(j + 1) - t0) : d;
+		}
+		else {
+			// Fritsch-Butland tangents: zero at extrema, harmonic mean otherwise
+			auto tangent = [](float a, float b) { return a * b > 0 ? 2 * a * b / (a + b) : 0.0f; };
+			m0 = tangent(d_prev, d);
+			m1 = tangent(d, d_next);
 		}
-		*target = value;
+		return hermite(p0, p1, m0, m1, u, dt);
 	}
 
-	void Event::filter(bool is_backwards)
+	void Event::segment(double frame, size_t& cursor, size_t& i, size_t& j, float& u) const
+	{
+		float frameNorm = (float)((frame - time) / duration);
+		size_t n = keyframes.size();
+		size_t key = seek(frameNorm, cursor);
+		u = 0;
+		if (key == 0 || key == n) {
+			i = j = key == 0 ? 0 : n - 1;
+			return;
+		}
+		i = key - 1;
+		j = key;
+		float dt = keyframes.time(j) - keyframes.time(i);
+		u = dt > 0 ? (frameNorm - keyframes.time(i)) / dt : 0;
+	}
+
+	void Event::bake(int from, int to)
+	{
+		baked.resize(to - from + 1);
+		bakedFrom = from;
+		for (int frame = from; frame <= to; frame++) {
+			baked[frame - from] = value(frame);
+		}
+	}
+
+	bool Event::isBaked(int from, int to) const
+	{
+		return !baked.empty() && bakedFrom == from && (int)baked.size() == to - from + 1;
+	}
+
+	void Event::invalidate()
+	{
+		baked.clear();
+		baked.shrink_to_fit();
+	}
+
+	void Event::edited()
+	{
+		invalidate();
+		pyramid.clear();
+	}
+
+	size_t Keyframes::lower_bound(float t) const
+	{
+		size_t n = size();
+		if (!uniform()) return search(t, false);
+		if (t <= 0) return 0;
+		if (n < 2 || t > 1) return n;
+		size_t i = (size_t)ceil(t * (n - 1));
+		// Fix the rounding of the estimate
+		while (i > 0 && time(i - 1) >= t) i--;
+		while (i < n && time(i) < t) i++;
+		return i;
+	}
+
+	size_t Keyframes::upper_bound(float t) const
+	{
+		if (!uniform()) return search(t, true);
+		size_t i = lower_bound(t), n = size();
+		while (i < n && time(i) <= t) i++;
+		return i;
+	}
+
+	size_t Keyframes::search(float t, bool is_upper) const
+	{
+		auto before = [&](float key_time) { return is_upper ? key_time <= t : key_time < t; };
+		// The chunk with the key, by the last time of each chunk
+		size_t lo = 0, hi = chunks.size();
+		while (lo < hi) {
+			size_t c = (lo + hi) / 2;
+			if (before(time_chunks[c].get()[chunkSize(c) - 1])) lo = c + 1;
+			else hi = c;
+		}
+		if (lo == chunks.size()) return size();
+		const float* times = time_chunks[lo].get();
+		return starts[lo] + (std::partition_point(times, times + chunkSize(lo), before) - times);
+	}
+
+	// Chunks allocated here carry this deleter. Any other chunk, e.g. one in
+	// a mapped take file, is read only
+	static std::shared_ptr<float> allocateChunk(size_t n)
+	{
+		return std::shared_ptr<float>(new float[n](), std::default_delete<float[]>());
+	}
+
+	static bool isOwned(const std::shared_ptr<const float>& chunk)
+	{
+		return std::get_deleter<std::default_delete<float[]>>(chunk) != nullptr;
+	}
+
+	void Keyframes::chunked(size_t n)
+	{
+		starts.clear();
+		if (n == 0) return;
+		for (size_t i = 0; i < n; i += CHUNK) starts.push_back(i);
+		starts.push_back(n);
+		is_regular = true;
+	}
+
+	void Keyframes::updated()
+	{
+		is_regular = true;
+		for (size_t c = 0; c + 1 < starts.size() && is_regular; c++) is_regular = starts[c] == c * CHUNK;
+	}
+
+	float* Keyframes::edit(size_t c)
+	{
+		std::shared_ptr<const float>& chunk = chunks[c];
+		if (chunk.use_count() > 1 || !isOwned(chunk)) {
+			std::shared_ptr<float> copy = allocateChunk(chunkSize(c));
+			std::copy(chunk.get(), chunk.get() + chunkSize(c), copy.get());
+			chunk = std::move(copy);
+		}
+		return const_cast<float*>(chunk.get());
+	}
+
+	void Keyframes::write(size_t i, const float* values, size_t n)
+	{
+		while (n > 0) {
+			size_t c = locate(i), at = i - starts[c];
+			size_t m = std::min(n, chunkSize(c) - at);
+			std::copy(values, values + m, edit(c) + at);
+			values += m;
+			i += m;
+			n -= m;
+		}
+	}
+
+	void Keyframes::resize(size_t n)
+	{
+		size_t count = size();
+		if (n == count) return;
+		if (n == 0) {
+			clear();
+			return;
+		}
+		// Chunks below both sizes stay as they are; the one at the end is
+		// reallocated, and then filled up to CHUNK keys before adding others
+		size_t c = count == 0 ? 0 : locate(std::min(n, count) - 1);
+		std::shared_ptr<const float> last = c < chunks.size() ? chunks[c] : nullptr;
+		size_t at = c < chunks.size() ? starts[c] : 0;
+		size_t kept = last ? std::min(n, count) - at : 0;
+		chunks.resize(c);
+		starts.resize(c);
+		while (at < n) {
+			size_t m = std::min(CHUNK, n - at);
+			std::shared_ptr<float> chunk = allocateChunk(m);
+			if (kept) std::copy(last.get(), last.get() + std::min(kept, m), chunk.get());
+			kept = 0;
+			chunks.push_back(std::move(chunk));
+			starts.push_back(at);
+			at += m;
+		}
+		starts.push_back(n);
+		updated();
+	}
+
+	void Keyframes::splice(size_t from, size_t to, const float* values, const float* key_times, size_t n)
+	{
+		if (uniform()) {
+			if (n == to - from) write(from, values, n);
+			else if (to == size()) {
+				resize(from + n);
+				write(from, values, n);
+			}
+			else {
+				std::vector<float> keys = copy();
+				keys.erase(keys.begin() + from, keys.begin() + to);
+				keys.insert(keys.begin() + from, values, values + n);
+				assign(std::move(keys));
+			}
+			return;
+		}
+		// The chunks holding keys from to to - 1 are rebuilt. A short result
+		// takes in the next chunk, so repeated splices don't fragment the keys
+		size_t first = from < size() ? locate(from) : chunks.size() - 1;
+		size_t last = to > from ? locate(to - 1) + 1 : first + 1;
+		size_t begin = starts[first];
+		size_t m = from - begin + n + starts[last] - to;
+		if (m < CHUNK / 2 && last < chunks.size()) m += chunkSize(last++);
+		if (m < CHUNK / 2 && first > 0) m += chunkSize(--first);
+		begin = starts[first];
+		std::vector<float> keys, times;
+		keys.reserve(m);
+		times.reserve(m);
+		auto add = [&](size_t a, size_t b) {
+			for (size_t c = first; c < last; c++) {
+				size_t lo = std::max(a, starts[c]), hi = std::min(b, starts[c + 1]);
+				if (lo >= hi) continue;
+				keys.insert(keys.end(), chunk(c) + lo - starts[c], chunk(c) + hi - starts[c]);
+				times.insert(times.end(), timeChunk(c) + lo - starts[c], timeChunk(c) + hi - starts[c]);
+			}
+		};
+		add(begin, from);
+		keys.insert(keys.end(), values, values + n);
+		times.insert(times.end(), key_times, key_times + n);
+		add(to, starts[last]);
+
+		std::vector<std::shared_ptr<const float>> new_chunks, new_times;
+		std::vector<size_t> new_starts;
+		for (size_t i = 0; i < keys.size(); i += CHUNK) {
+			size_t k = std::min(CHUNK, keys.size() - i);
+			std::shared_ptr<float> chunk = allocateChunk(k), time_chunk = allocateChunk(k);
+			std::copy(keys.data() + i, keys.data() + i + k, chunk.get());
+			std::copy(times.data() + i, times.data() + i + k, time_chunk.get());
+			new_chunks.push_back(std::move(chunk));
+			new_times.push_back(std::move(time_chunk));
+			new_starts.push_back(begin + i);
+		}
+		chunks.erase(chunks.begin() + first, chunks.begin() + last);
+		chunks.insert(chunks.begin() + first, new_chunks.begin(), new_chunks.end());
+		time_chunks.erase(time_chunks.begin() + first, time_chunks.begin() + last);
+		time_chunks.insert(time_chunks.begin() + first, new_times.begin(), new_times.end());
+		// Only the starts move past the splice
+		std::ptrdiff_t moved = (std::ptrdiff_t)n - (std::ptrdiff_t)(to - from);
+		std::vector<size_t> after(starts.begin() + last, starts.end());
+		starts.resize(first);
+		starts.insert(starts.end(), new_starts.begin(), new_starts.end());
+		for (size_t start : after) starts.push_back(start + moved);
+		if (chunks.empty()) starts.clear();
+		updated();
+	}
+
+	std::vector<float> Keyframes::copy() const
+	{
+		std::vector<float> values;
+		values.reserve(size());
+		for (size_t c = 0; c < chunks.size(); c++) values.insert(values.end(), chunk(c), chunk(c) + chunkSize(c));
+		return values;
+	}
+
+	std::vector<float> Keyframes::copyTimes() const
+	{
+		if (uniform()) {
+			std::vector<float> times(size());
+			for (size_t i = 0; i < times.size(); i++) times[i] = time(i);
+			return times;
+		}
+		std::vector<float> times;
+		times.reserve(size());
+		for (size_t c = 0; c < chunks.size(); c++) times.insert(times.end(), timeChunk(c), timeChunk(c) + chunkSize(c));
+		return times;
+	}
+
+	void Keyframes::assign(std::vector<float> keys, std::shared_ptr<const float> key_times)
 	{
-		// First-order Butterworth filter coefficients
-		// These coefficients obtained in python via lines:
-		// ...
-		// from scipy import signal
-		// b, a = signal.butter(1, 0.4)
+		clear();
+		chunked(keys.size());
+		for (size_t c = 0; c + 1 < starts.size(); c++) {
+			std::shared_ptr<float> chunk = allocateChunk(chunkSize(c));
+			std::copy(keys.data() + starts[c], keys.data() + starts[c + 1], chunk.get());
+			chunks.push_back(std::move(chunk));
+			// The time chunks point into the column and share its ownership
+			if (key_times) time_chunks.emplace_back(key_times, key_times.get() + starts[c]);
+		}
+	}
+
+	void Keyframes::replace(const std::vector<float>& keys)
+	{
+		for (size_t c = 0; c < chunkCount(); c++) {
+			std::shared_ptr<float> chunk = allocateChunk(chunkSize(c));
+			std::copy(keys.data() + starts[c], keys.data() + starts[c + 1], chunk.get());
+			chunks[c] = std::move(chunk);
+		}
+	}
+
+	void Keyframes::view(std::shared_ptr<const float> keys, size_t n, std::shared_ptr<const float> key_times)
+	{
+		clear();
+		chunked(n);
+		// The chunks point into the keys and share their ownership
+		for (size_t c = 0; c + 1 < starts.size(); c++) {
+			chunks.emplace_back(keys, keys.get() + starts[c]);
+			if (key_times) time_chunks.emplace_back(key_times, key_times.get() + starts[c]);
+		}
+	}
+
+	bool Keyframes::isView() const
+	{
+		return !chunks.empty() && !isOwned(chunks[0]);
+	}
 
-		float b[] = { 0.42080778, 0.42080778 };
-		float a[] = { 1., -0.15838444 };
-		if (is_backwards) std::reverse(keyframes.begin(), keyframes.end());
+	bool Keyframes::sameTimes(const Keyframes& other) const
+	{
+		if (uniform() || other.uniform()) return uniform() && other.uniform() && size() == other.size();
+		return starts == other.starts && time_chunks == other.time_chunks;
+	}
 
-		float last_x = keyframes[0].second;
-		float last_y = last_x;
-		for (std::pair<float, float>& key : keyframes) {
-			float y = b[0] * key.second + b[1] * last_x - a[1] * last_y;
-			last_x = key.second;
-			last_y = y;
-			key.second = y;
+	bool Keyframes::shareTimes(const Keyframes& other)
+	{
+		if (uniform() || other.uniform() || starts != other.starts) return false;
+		for (size_t c = 0; c < chunkCount(); c++) {
+			if (time_chunks[c] == other.time_chunks[c]) continue;
+			if (!std::equal(timeChunk(c), timeChunk(c) + chunkSize(c), other.timeChunk(c))) return false;
 		}
-		if (is_backwards) std::reverse(keyframes.begin(), keyframes.end());
+		time_chunks = other.time_chunks;
+		return true;
+	}
+
+	std::shared_ptr<const float> Keyframes::column(std::vector<float> times)
+	{
+		auto owner = std::make_shared<const std::vector<float>>(std::move(times));
+		return std::shared_ptr<const float>(owner, owner->data());
+	}
+
+	std::shared_ptr<const float> Keyframes::frameTimes(const std::vector<int>& frames)
+	{
+		std::vector<float> times(frames.size());
+		float span = frames.back() - frames.front();
+		for (size_t i = 0; i < frames.size(); i++) times[i] = (frames[i] - frames.front()) / span;
+		return column(std::move(times));
+	}
+
+	void CurvePyramid::build(const Keyframes& keys)
+	{
+		clear();
+		size_t n = keys.size();
+		if (n < 2) return;
+		// Level 1 reads the keys, the others the level below
+		size_t m = (n + 1) / 2;
+		mins.emplace_back(m);
+		maxs.emplace_back(m);
+		for (size_t i = 0; i < m; i++) {
+			float a = keys.value(2 * i), b = keys.value(std::min(2 * i + 1, n - 1));
+			mins[0][i] = std::min(a, b);
+			maxs[0][i] = std::max(a, b);
+		}
+		const float* lo = mins[0].data();
+		const float* hi = maxs[0].data();
+		n = m;
+		while (n > 1) {
+			size_t m = (n + 1) / 2;
+			std::vector<float> level_min(m), level_max(m);
+			for (size_t i = 0; i < m; i++) {
+				size_t a = 2 * i, b = std::min(2 * i + 1, n - 1);
+				level_min[i] = std::min(lo[a], lo[b]);
+				level_max[i] = std::max(hi[a], hi[b]);
+			}
+			mins.push_back(std::move(level_min));
+			maxs.push_back(std::move(level_max));
+			lo = mins.back().data();
+			hi = maxs.back().data();
+			n = m;
+		}
+	}
+
+	void CurvePyramid::range(const Keyframes& keys, size_t from, size_t to, float& lo, float& hi) const
+	{
+		lo = INFINITY;
+		hi = -INFINITY;
+		// Bottom-up: take the unpaired elements at each end, then go a level up
+		for (size_t level = 0; from < to; level++) {
+			auto lowest = [&](size_t i) { return level == 0 ? keys.value(i) : mins[level - 1][i]; };
+			auto highest = [&](size_t i) { return level == 0 ? keys.value(i) : maxs[level - 1][i]; };
+			if (from & 1) {
+				lo = std::min(lo, lowest(from));
+				hi = std::max(hi, highest(from));
+				from++;
+			}
+			if (to & 1) {
+				to--;
+				lo = std::min(lo, lowest(to));
+				hi = std::max(hi, highest(to));
+			}
+			from /= 2;
+			to /= 2;
+		}
+	}
+
+	size_t Event::seek(float t) const
+	{
+		return seek(t, playhead);
+	}
+
+	size_t Event::seek(float t, size_t& cursor) const
+	{
+		// Returns the number of keys with time <= t
+		size_t n = keyframes.size();
+		if (cursor > n) cursor = n;
+
+		// Uniform keys: jump straight to the estimate; the walk below fixes rounding
+		if (keyframes.uniform() && n > 1 && t >= 0 && t <= 1) cursor = (size_t)(t * (n - 1)) + 1;
+
+		// Sequential playback: walk from the previous position
+		for (int step = 0; step < 4; step++) {
+			if (cursor < n && keyframes.time(cursor) <= t) cursor++;
+			else if (cursor > 0 && keyframes.time(cursor - 1) > t) cursor--;
+			else return cursor;
+		}
+
+		// Random seek (scrubbing, range drag, begin()): binary search
+		if (keyframes.uniform()) {
+			cursor = t < 0 ? 0 : n;
+			return cursor;
+		}
+		cursor = keyframes.upper_bound(t);
+		return cursor;
+	}
+
+	void Event::filter(bool is_backwards)
+	{
+		std::vector<float> keys = keyframes.copy();
+		float* values = keys.data();
+		biquads(&values, 1, keys.size(), butterworth(1, 0.4f), is_backwards);
+		keyframes.replace(keys);
+		edited();
 	}
 
 	void Event::filter()
 	{
-		if (keyframes.size() == 0) return;
-		filter(false);
-		filter(true);
+		filter(FilterSettings());
+	}
+
+	void Event::filter(const FilterSettings& settings)
+	{
+		std::vector<float> keys = keyframes.copy();
+		float* values = keys.data();
+		VRaF::filter(&values, 1, keys.size(), settings);
+		keyframes.replace(keys);
+		edited();
 	}
 
 	void Event::clear()
 	{
 		keyframes.clear();
+		playhead = 0;
+		edited();
 		time = 0;
 		duration = 0;
 	}
+
+	void Event::splice(int start, std::vector<float> values, const std::vector<int>& frames, int crossfade)
+	{
+		auto frameOf = [&](size_t i) { return frames.empty() ? start + (int)i : frames[i]; };
+		int end = frameOf(values.size() - 1);
+		playhead = 0;
+		edited();
+		if (keyframes.empty()) {
+			time = start;
+			duration = end - start;
+			// Contiguous frames make uniform keys
+			if (frames.empty() || duration == 0) keyframes.assign(std::move(values));
+			else keyframes.assign(std::move(values), Keyframes::frameTimes(frames));
+			return;
+		}
+		if (interpolation == INTERPOLATION_BSPLINE) {
+			// Control points can't be spliced; sample the spline at every frame
+			std::vector<float> samples(duration + 1);
+			for (int f = 0; f <= duration; f++) samples[f] = value(time + f);
+			keyframes.assign(std::move(samples));
+			interpolation = INTERPOLATION_LINEAR;
+		}
+
+		int from = time, to = time + duration;
+		if (crossfade > 0) {
+			for (size_t i = 0; i < values.size(); i++) {
+				int f = frameOf(i);
+				float w = (float)(std::min(f - start, end - f) + 1) / (crossfade + 1);
+				if (w >= 1 || f < from || f > to) continue;
+				float old = value(f);
+				values[i] = old + (values[i] - old) * w;
+			}
+		}
+
+		// A key per frame stays so: the recorded frames are overwritten in place
+		size_t n = keyframes.size();
+		if (keyframes.uniform() && (int)n == duration + 1 && frames.empty() && start <= to + 1 && end >= from - 1) {
+			if (start < from) {
+				// Recorded before the event: every key moves
+				std::vector<float> keys = keyframes.copy();
+				keys.insert(keys.begin(), from - start, 0.0f);
+				keyframes.assign(std::move(keys));
+				time = start;
+			}
+			if (end > to) keyframes.resize(end - time + 1);
+			keyframes.write(start - time, values.data(), values.size());
+			duration = (int)keyframes.size() - 1;
+			return;
+		}
+
+		// Otherwise the old keys before and after the recorded frames are kept,
+		// plus a key on each side holding the old curve up to the recording
+		size_t before = from < start ? n : 0, after = from > end ? 0 : n;
+		if (duration > 0) {
+			before = keyframes.lower_bound((start - 0.5f - from) / duration);
+			after = keyframes.lower_bound((end + 0.5f - from) / duration);
+		}
+		auto keyFrame = [&](size_t i) { return from + keyframes.time(i) * duration; };
+		bool has_punch_in = start - 1 >= from && start - 1 <= to && (before == 0 || keyFrame(before - 1) < start - 1.5);
+		bool has_punch_out = end + 1 >= from && end + 1 <= to && (after == n || keyFrame(after) > end + 1.5);
+		float punch_in = has_punch_in ? value(start - 1) : 0, punch_out = has_punch_out ? value(end + 1) : 0;
+
+		// Keys kept on both sides keep the event span, and so the times of
+		// the other keys: only the chunks around the recording are rewritten
+		if (!keyframes.uniform() && before > 0 && after < n) {
+			std::vector<float> keys, key_times;
+			auto add = [&](int f, float v) {
+				keys.push_back(v);
+				key_times.push_back((float)((double)(f - from) / duration));
+			};
+			if (has_punch_in) add(start - 1, punch_in);
+			for (size_t i = 0; i < values.size(); i++) add(frameOf(i), values[i]);
+			if (has_punch_out) add(end + 1, punch_out);
+			keyframes.splice(before, after, keys.data(), key_times.data(), keys.size());
+			return;
+		}
+
+		std::vector<double> key_frames;
+		std::vector<float> keys;
+		key_frames.reserve(before + values.size() + n - after + 2);
+		keys.reserve(key_frames.capacity());
+		for (size_t i = 0; i < before; i++) {
+			key_frames.push_back(keyFrame(i));
+			keys.push_back(keyframes.value(i));
+		}
+		if (has_punch_in) {
+			key_frames.push_back(start - 1);
+			keys.push_back(punch_in);
+		}
+		for (size_t i = 0; i < values.size(); i++) {
+			key_frames.push_back(frameOf(i));
+			keys.push_back(values[i]);
+		}
+		if (has_punch_out) {
+			key_frames.push_back(end + 1);
+			keys.push_back(punch_out);
+		}
+		for (size_t i = after; i < n; i++) {
+			key_frames.push_back(keyFrame(i));
+			keys.push_back(keyframes.value(i));
+		}
+
+		double first = key_frames.front(), span = key_frames.back() - first;
+		time = (int)std::lround(first);
+		duration = (int)std::lround(span);
+		bool is_uniform = true;
+		for (size_t i = 0; i < key_frames.size() && is_uniform; i++) is_uniform = key_frames[i] == first + i;
+		if (is_uniform || span == 0) {
+			keyframes.assign(std::move(keys));
+			return;
+		}
+		std::vector<float> key_times(key_frames.size());
+		for (size_t i = 0; i < key_frames.size(); i++) key_times[i] = (float)((key_frames[i] - first) / span);
+		keyframes.assign(std::move(keys), Keyframes::column(std::move(key_times)));
+	}
 	void Recording::update(int frame)
 	{
-		keyframes.push_back({ frame, *target });
+		add(frame, *target);
+	}
+
+	void Recording::add(int frame, float value)
+	{
+		// Several samples per frame: the latest wins. Frames without a sample
+		// hold the previous value, so the frames stay contiguous
+		auto filtered = [&](float x) { return is_filtered ? filter(x) : x; };
+		if (!is_started) {
+			is_started = true;
+			start = frame;
+		}
+		else {
+			if (frame < last_frame) return;
+			if (frame == last_frame) {
+				filter = before_last;
+				last = filtered(value);
+				raw_last = value;
+				return;
+			}
+			settle(last_frame, last);
+			while (++last_frame < frame) settle(last_frame, filtered(raw_last));
+		}
+		before_last = filter;
+		last_frame = frame;
+		last = filtered(value);
+		raw_last = value;
+	}
+
+	void Recording::settle(int frame, float value)
+	{
+		if (deadband <= 0) {
+			values.push_back(value);
+			return;
+		}
+		size_t n = values.size();
+		bool is_stored = n == 0;
+		if (n > 0) {
+			float predicted = values[n - 1];
+			if (is_extrapolated && n >= 2) {
+				predicted += (values[n - 1] - values[n - 2]) / (frames[n - 1] - frames[n - 2]) * (frame - frames[n - 1]);
+			}
+			is_stored = std::abs(value - predicted) > deadband;
+			// Interpolated playback would ramp across the skipped frames, so the
+			// one before the change is stored as well
+			if (is_stored && is_extrapolated && settled_frame > frames.back()) {
+				frames.push_back(settled_frame);
+				values.push_back(settled);
+			}
+			is_stored |= max_gap > 0 && frame - frames.back() >= max_gap;
+		}
+		if (is_stored) {
+			frames.push_back(frame);
+			values.push_back(value);
+		}
+		settled_frame = frame;
+		settled = value;
+	}
+
+	void Recording::finish()
+	{
+		if (!is_started) return;
+		settle(last_frame, last);
+		is_started = false;
+		// The recording spans up to its last frame
+		if (deadband > 0 && frames.back() != last_frame) {
+			frames.push_back(last_frame);
+			values.push_back(last);
+		}
 	}
 
 	SeqIterator Sequencer::begin() {
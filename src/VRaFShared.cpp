@@ -0,0 +1,233 @@
+#include "VRaFShared.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace VRaF {
+
+	static uint64_t aligned(uint64_t offset)
+	{
+		return (offset + SHARED_ALIGNMENT - 1) / SHARED_ALIGNMENT * SHARED_ALIGNMENT;
+	}
+
+#ifdef _WIN32
+	// Named mappings live as long as a handle is open, without a leading slash
+	static std::string mappingName(const std::string& name)
+	{
+		return name.starts_with("/") ? name.substr(1) : name;
+	}
+#else
+	static std::string mappingName(const std::string& name)
+	{
+		return name.starts_with("/") ? name : "/" + name;
+	}
+#endif
+
+	std::unique_ptr<SharedMemory> SharedMemory::create(const std::string& name, size_t size)
+	{
+		std::unique_ptr<SharedMemory> memory(new SharedMemory());
+		memory->name = mappingName(name);
+#ifdef _WIN32
+		HANDLE mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+			(DWORD)((uint64_t)size >> 32), (DWORD)size, memory->name.c_str());
+		if (!mapping) return nullptr;
+		memory->handle = mapping;
+		memory->bytes = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		if (!memory->bytes) return nullptr;
+#else
+		shm_unlink(memory->name.c_str());
+		int fd = shm_open(memory->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+		if (fd < 0) return nullptr;
+		memory->is_owner = true;
+		if (ftruncate(fd, size) != 0) {
+			close(fd);
+			return nullptr;
+		}
+		void* bytes = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (bytes == MAP_FAILED) return nullptr;
+		memory->bytes = (uint8_t*)bytes;
+#endif
+		memory->length = size;
+		return memory;
+	}
+
+	std::unique_ptr<SharedMemory> SharedMemory::attach(const std::string& name)
+	{
+		std::unique_ptr<SharedMemory> memory(new SharedMemory());
+		memory->name = mappingName(name);
+#ifdef _WIN32
+		HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, memory->name.c_str());
+		if (!mapping) return nullptr;
+		memory->handle = mapping;
+		memory->bytes = (uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!memory->bytes) return nullptr;
+		MEMORY_BASIC_INFORMATION info;
+		if (!VirtualQuery(memory->bytes, &info, sizeof(info))) return nullptr;
+		memory->length = info.RegionSize;
+#else
+		int fd = shm_open(memory->name.c_str(), O_RDONLY, 0);
+		if (fd < 0) return nullptr;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0) {
+			close(fd);
+			return nullptr;
+		}
+		void* bytes = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (bytes == MAP_FAILED) return nullptr;
+		memory->bytes = (uint8_t*)bytes;
+		memory->length = info.st_size;
+#endif
+		return memory;
+	}
+
+	SharedMemory::~SharedMemory()
+	{
+#ifdef _WIN32
+		if (bytes) UnmapViewOfFile(bytes);
+		if (handle) CloseHandle(handle);
+#else
+		if (bytes) munmap(bytes, length);
+		if (is_owner) shm_unlink(name.c_str());
+#endif
+	}
+
+	std::unique_ptr<SharedFramePublisher> SharedFramePublisher::create(const std::string& name, int fps,
+		const std::vector<SharedTrackInfo>& tracks, int slots)
+	{
+		uint32_t channels = 0;
+		uint64_t labels_size = 0;
+		for (const SharedTrackInfo& t : tracks) {
+			channels = std::max(channels, (uint32_t)(t.first_channel + t.components));
+			labels_size += t.label.size();
+		}
+		uint64_t labels_offset = sizeof(SharedHeader) + tracks.size() * sizeof(SharedTrack);
+		uint64_t slots_offset = aligned(labels_offset + labels_size);
+		uint64_t slot_size = aligned(sizeof(SharedSlot) + channels * sizeof(float));
+
+		std::unique_ptr<SharedFramePublisher> publisher(new SharedFramePublisher());
+		publisher->memory = SharedMemory::create(name, slots_offset + slots * slot_size);
+		if (!publisher->memory) return nullptr;
+		uint8_t* bytes = publisher->memory->data();
+		// Fresh memory is zeroed: no frame published, every slot sequence 0
+		SharedHeader* header = new (bytes) SharedHeader();
+		header->version = SHARED_VERSION;
+		header->header_size = sizeof(SharedHeader);
+		header->fps = fps;
+		header->channel_count = channels;
+		header->track_count = tracks.size();
+		header->slot_count = slots;
+		header->labels_offset = labels_offset;
+		header->labels_size = labels_size;
+		header->slots_offset = slots_offset;
+		header->slot_size = slot_size;
+		header->published.store(0, std::memory_order_relaxed);
+
+		SharedTrack* shared_tracks = (SharedTrack*)(bytes + sizeof(SharedHeader));
+		char* labels = (char*)(bytes + labels_offset);
+		uint32_t label_offset = 0;
+		for (size_t i = 0; i < tracks.size(); i++) {
+			const SharedTrackInfo& t = tracks[i];
+			shared_tracks[i] = { label_offset, (uint32_t)t.label.size(), (uint32_t)t.first_channel, (uint32_t)t.components };
+			memcpy(labels + label_offset, t.label.data(), t.label.size());
+			label_offset += t.label.size();
+		}
+		for (int i = 0; i < slots; i++) new (bytes + slots_offset + i * slot_size) SharedSlot();
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(header->magic, SHARED_MAGIC, sizeof(SHARED_MAGIC));
+		publisher->header = header;
+		return publisher;
+	}
+
+	void SharedFramePublisher::publish(uint64_t version, double frame, const float* values, int count)
+	{
+		uint8_t* bytes = memory->data();
+		SharedSlot* slot = (SharedSlot*)(bytes + header->slots_offset + (version - 1) % header->slot_count * header->slot_size);
+		slot->sequence.store(2 * version - 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot->frame = frame;
+		memcpy((float*)(slot + 1), values, std::min(count, (int)header->channel_count) * sizeof(float));
+		slot->sequence.store(2 * version, std::memory_order_release);
+		header->published.store(version, std::memory_order_release);
+	}
+
+	std::unique_ptr<SharedFrameReader> SharedFrameReader::attach(const std::string& name)
+	{
+		std::unique_ptr<SharedFrameReader> reader(new SharedFrameReader());
+		reader->memory = SharedMemory::attach(name);
+		if (!reader->memory || reader->memory->size() < sizeof(SharedHeader)) return nullptr;
+		const uint8_t* bytes = reader->memory->data();
+		const SharedHeader* header = (const SharedHeader*)bytes;
+		if (memcmp(header->magic, SHARED_MAGIC, sizeof(SHARED_MAGIC)) != 0) return nullptr;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		size_t size = reader->memory->size();
+		if (header->version != SHARED_VERSION || header->slot_count == 0
+			|| header->labels_offset + header->labels_size > size
+			|| header->header_size + (uint64_t)header->track_count * sizeof(SharedTrack) > header->labels_offset
+			|| header->slot_size < sizeof(SharedSlot) + header->channel_count * sizeof(float)
+			|| header->slots_offset + header->slot_count * header->slot_size > size) return nullptr;
+
+		const SharedTrack* tracks = (const SharedTrack*)(bytes + header->header_size);
+		const char* labels = (const char*)(bytes + header->labels_offset);
+		for (uint32_t i = 0; i < header->track_count; i++) {
+			const SharedTrack& t = tracks[i];
+			if ((uint64_t)t.label_offset + t.label_size > header->labels_size) return nullptr;
+			reader->track_infos.push_back({ std::string(labels + t.label_offset, t.label_size), (int)t.first_channel, (int)t.components });
+		}
+		reader->header = header;
+		return reader;
+	}
+
+	int SharedFrameReader::channel(const std::string& label) const
+	{
+		for (const SharedTrackInfo& t : track_infos) {
+			if (t.label == label) return t.first_channel;
+		}
+		return -1;
+	}
+
+	const SharedSlot* SharedFrameReader::slot(uint64_t version) const
+	{
+		if (version == 0) return nullptr;
+		const uint8_t* bytes = memory->data();
+		return (const SharedSlot*)(bytes + header->slots_offset + (version - 1) % header->slot_count * header->slot_size);
+	}
+
+	const float* SharedFrameReader::values(uint64_t version, double* frame) const
+	{
+		const SharedSlot* s = slot(version);
+		if (!s || s->sequence.load(std::memory_order_acquire) != 2 * version) return nullptr;
+		if (frame) *frame = s->frame;
+		return (const float*)(s + 1);
+	}
+
+	bool SharedFrameReader::intact(uint64_t version) const
+	{
+		const SharedSlot* s = slot(version);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return s && s->sequence.load(std::memory_order_relaxed) == 2 * version;
+	}
+
+	bool SharedFrameReader::read(uint64_t version, float* out, double* frame) const
+	{
+		double f;
+		const float* v = values(version, &f);
+		if (!v) return false;
+		memcpy(out, v, header->channel_count * sizeof(float));
+		if (!intact(version)) return false;
+		if (frame) *frame = f;
+		return true;
+	}
+}
@@ -0,0 +1,314 @@
+#include "VRaFSequencer.h"
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+namespace VRaF {
+
+	// Channels [first, first + count) of a group, played back together by the
+	// kernel of their track, or a single channel without one
+	struct ChannelUnit {
+		size_t first;
+		int count;
+		const ChannelKernel* kernel;
+	};
+
+	// Largest distance over the components between a played value and key i,
+	// measured in the filter domain of the kernel, where e.g. q and -q are the
+	// same rotation and colors are in linear light
+	static float distance(const std::vector<const Keyframes*>& channels, const ChannelUnit& unit, const float* played, size_t i)
+	{
+		float pair[MAX_COMPONENTS][2];
+		float* columns[MAX_COMPONENTS];
+		for (int c = 0; c < unit.count; c++) {
+			pair[c][0] = played[c];
+			pair[c][1] = channels[unit.first + c]->value(i);
+			columns[c] = pair[c];
+		}
+		if (unit.kernel) unit.kernel->encode(columns, 2);
+		float error = 0;
+		for (int c = 0; c < unit.count; c++) error = std::max(error, std::abs(pair[c][1] - pair[c][0]));
+		return error;
+	}
+
+	// Largest distance over the channels between key i and the curve from key a
+	// to key b, blended by the kernels
+	static float linearError(const std::vector<const Keyframes*>& channels, const std::vector<ChannelUnit>& units,
+		size_t a, size_t b, size_t i)
+	{
+		const Keyframes& k = *channels[0];
+		float dt = k.time(b) - k.time(a);
+		float u = dt > 0 ? (k.time(i) - k.time(a)) / dt : 0;
+		float error = 0;
+		float from[MAX_COMPONENTS], to[MAX_COMPONENTS], line[MAX_COMPONENTS];
+		for (const ChannelUnit& unit : units) {
+			for (int c = 0; c < unit.count; c++) {
+				from[c] = channels[unit.first + c]->value(a);
+				to[c] = channels[unit.first + c]->value(b);
+			}
+			if (unit.kernel) unit.kernel->blend(from, to, u, line);
+			else line[0] = from[0] + (to[0] - from[0]) * u;
+			error = std::max(error, distance(channels, unit, line, i));
+		}
+		return error;
+	}
+
+	// Marks the keys to keep, so that the curve through them stays within
+	// tolerance of every dropped key. Only keys between first and last may be
+	// dropped; kept[i - first] is for key i. The channels share their key times
+	static std::vector<bool> simplifyKeys(const std::vector<const Keyframes*>& channels, const std::vector<ChannelUnit>& units,
+		Interpolation mode, float tolerance, size_t first, size_t last)
+	{
+		const Keyframes& k = *channels[0];
+		size_t n = k.size();
+		std::vector<bool> kept(last - first + 1, true);
+		if (last < first + 2) return kept;
+		std::fill(kept.begin() + 1, kept.end() - 1, false);
+
+		if (mode == INTERPOLATION_STEP) {
+			// A key is needed once the held value strays too far
+			size_t held = first;
+			float value[MAX_COMPONENTS];
+			for (size_t i = first + 1; i < last; i++) {
+				for (const ChannelUnit& unit : units) {
+					for (int c = 0; c < unit.count; c++) value[c] = channels[unit.first + c]->value(held);
+					if (distance(channels, unit, value, i) > tolerance) {
+						kept[i - first] = true;
+						held = i;
+						break;
+					}
+				}
+			}
+			return kept;
+		}
+
+		// Ramer-Douglas-Peucker, exact for linear interpolation
+		std::vector<std::pair<size_t, size_t>> segments = { { first, last } };
+		while (!segments.empty()) {
+			auto [a, b] = segments.back();
+			segments.pop_back();
+			size_t worst = a;
+			float worst_error = tolerance;
+			for (size_t i = a + 1; i < b; i++) {
+				float error = linearError(channels, units, a, b, i);
+				if (error > worst_error) {
+					worst = i;
+					worst_error = error;
+				}
+			}
+			if (worst == a) continue;
+			kept[worst - first] = true;
+			segments.push_back({ a, worst });
+			segments.push_back({ worst, b });
+		}
+		if (mode == INTERPOLATION_LINEAR) return kept;
+
+		// Smooth modes bend between the keys, so evaluate them and add the worst
+		// dropped key of every segment still out of tolerance. The tangents
+		// reach one key further, so a key on each side of the range is enough
+		std::vector<Event> curves(channels.size());
+		for (Event& curve : curves) {
+			curve.time = 0;
+			curve.duration = 1;
+			curve.interpolation = mode;
+		}
+		size_t from = first > 0 ? first - 1 : first;
+		size_t to = std::min(last + 1, n - 1);
+		std::vector<size_t> keys;
+		std::vector<float> times, values;
+		std::vector<float> errors(last - first + 1);
+		while (true) {
+			keys.clear();
+			for (size_t i = from; i <= to; i++) if (i < first || i > last || kept[i - first]) keys.push_back(i);
+			times.clear();
+			for (size_t i : keys) times.push_back(k.time(i));
+			std::shared_ptr<const float> column = Keyframes::column(times);
+			std::fill(errors.begin(), errors.end(), 0.0f);
+			for (size_t c = 0; c < channels.size(); c++) {
+				values.clear();
+				for (size_t i : keys) values.push_back(channels[c]->value(i));
+				curves[c].keyframes.assign(values, column);
+			}
+			for (const ChannelUnit& unit : units) {
+				const Event* curve = &curves[unit.first];
+				size_t cursors[MAX_COMPONENTS] = {};
+				float played[MAX_COMPONENTS];
+				for (size_t i = first; i <= last; i++) {
+					if (unit.kernel) unit.kernel->evaluate(curve, k.time(i), cursors, played);
+					else played[0] = curve->value(k.time(i), cursors[0]);
+					errors[i - first] = std::max(errors[i - first], distance(channels, unit, played, i));
+				}
+			}
+			bool is_within = true;
+			for (size_t s = 0; s + 1 < keys.size(); s++) {
+				size_t worst = keys[s];
+				float worst_error = tolerance;
+				for (size_t i = std::max(keys[s] + 1, first); i < keys[s + 1] && i <= last; i++) {
+					if (errors[i - first] > worst_error) {
+						worst = i;
+						worst_error = errors[i - first];
+					}
+				}
+				if (worst == keys[s]) continue;
+				kept[worst - first] = true;
+				is_within = false;
+			}
+			if (is_within) return kept;
+		}
+	}
+
+	// Events with the same key times and interpolation, i.e. the components of
+	// a track recorded together, are processed together and keep sharing one
+	// time column. Spline control points aren't samples, so they're left alone.
+	// Each group is in track order, so the components of a track are adjacent
+	static std::vector<std::vector<Event*>> jointGroups(std::vector<Event*> pending, size_t min_keys)
+	{
+		std::vector<std::vector<Event*>> groups;
+		std::erase_if(pending, [&](Event* e) {
+			return e->keyframes.size() < min_keys || e->interpolation == INTERPOLATION_BSPLINE;
+		});
+		std::sort(pending.begin(), pending.end(), std::less<Event*>());
+		while (!pending.empty()) {
+			Event* first = pending[0];
+			auto isSame = [&](Event* e) {
+				return e->keyframes.size() == first->keyframes.size() && e->keyframes.sameTimes(first->keyframes)
+					&& e->interpolation == first->interpolation;
+			};
+			groups.emplace_back();
+			std::copy_if(pending.begin(), pending.end(), std::back_inserter(groups.back()), isSame);
+			std::erase_if(pending, isSame);
+		}
+		return groups;
+	}
+
+	// Tracks of types that aren't separable are a unit when all of their
+	// components are in the group; other channels are units of their own
+	static std::vector<ChannelUnit> channelUnits(const std::vector<Event*>& group)
+	{
+		std::vector<ChannelUnit> units;
+		for (size_t i = 0; i < group.size(); i++) {
+			const Event* e = group[i];
+			int n = e->kernel && e->component == 0 ? e->kernel->components : 1;
+			bool is_whole = n > 1 && i + n <= group.size();
+			for (int c = 1; is_whole && c < n; c++) is_whole = group[i + c] == e + c;
+			units.push_back({ i, is_whole ? n : 1, is_whole ? e->kernel : nullptr });
+			if (is_whole) i += n - 1;
+		}
+		return units;
+	}
+
+	void Sequencer::simplify(const std::vector<Event*>& events, float tolerance, int from, int to)
+	{
+		for (std::vector<Event*>& group : jointGroups(events, 3)) {
+			Event* first = group[0];
+			std::vector<const Keyframes*> channels;
+			for (Event* e : group) channels.push_back(&e->keyframes);
+			// Keys of the frame range
+			const Keyframes& k = first->keyframes;
+			size_t first_key = 0, last_key = k.size() - 1;
+			if (first->duration > 0 && from > first->time) first_key = k.lower_bound((from - 0.5f - first->time) / first->duration);
+			if (first->duration > 0 && to < first->time + first->duration) {
+				last_key = k.lower_bound((to + 0.5f - first->time) / first->duration);
+				if (last_key == 0) continue;
+				last_key--;
+			}
+			last_key = std::min(last_key, k.size() - 1);
+			std::vector<bool> kept = simplifyKeys(channels, channelUnits(group), first->interpolation, tolerance, first_key, last_key);
+			size_t n = std::count(kept.begin(), kept.end(), true);
+			if (n == kept.size()) continue;
+			// Uniform keys get times, so all of them are rewritten. Otherwise only
+			// the keys between the ends of the range are spliced, e.g. those of a
+			// punch-in, and the other chunks stay as they are
+			bool is_spliced = !k.uniform();
+			size_t from = is_spliced ? first_key + 1 : 0, to = is_spliced ? last_key : k.size();
+			auto isKept = [&](size_t i) { return i < first_key || i > last_key || kept[i - first_key]; };
+			std::vector<float> times;
+			for (size_t i = from; i < to; i++) if (isKept(i)) times.push_back(k.time(i));
+			std::shared_ptr<const float> column = is_spliced ? nullptr : Keyframes::column(times);
+			for (Event* e : group) {
+				std::vector<float> values;
+				values.reserve(times.size());
+				for (size_t i = from; i < to; i++) if (isKept(i)) values.push_back(e->keyframes.value(i));
+				if (is_spliced) {
+					e->keyframes.splice(from, to, values.data(), times.data(), values.size());
+					if (e != first) e->keyframes.shareTimes(first->keyframes);
+				}
+				else e->keyframes.assign(std::move(values), column);
+				e->playhead = 0;
+				e->edited();
+				if (is_spliced) journalSplice(*e, from, to, times.size());
+				else journalKeys(*e);
+			}
+		}
+	}
+
+	void Sequencer::simplify(std::string label, float tolerance)
+	{
+		for (Track& t : tracks) {
+			if (t.label != label) continue;
+			std::vector<Event*> events;
+			for (Event& e : t.events) events.push_back(&e);
+			simplify(events, tolerance);
+		}
+		checkpoint();
+	}
+
+	void Sequencer::simplify(float tolerance)
+	{
+		std::vector<Event*> events;
+		for (Track& t : tracks) {
+			for (Event& e : t.events) events.push_back(&e);
+		}
+		simplify(events, tolerance);
+		checkpoint();
+	}
+
+	void Sequencer::fit(const std::vector<Event*>& events, float smoothing, int points)
+	{
+		for (std::vector<Event*>& group : jointGroups(events, 4)) {
+			const Keyframes& keys = group[0]->keyframes;
+			size_t n = keys.size();
+			size_t m = std::clamp(points > 0 ? (size_t)points : n / 4, (size_t)4, n);
+			std::vector<std::vector<float>> samples;
+			samples.reserve(group.size());
+			std::vector<float*> channels;
+			std::vector<std::vector<float>> fitted(group.size(), std::vector<float>(m));
+			std::vector<float*> out;
+			for (size_t c = 0; c < group.size(); c++) {
+				samples.push_back(group[c]->keyframes.copy());
+				channels.push_back(samples.back().data());
+				out.push_back(fitted[c].data());
+			}
+			// Components of non-separable types are fitted in their filter domain,
+			// e.g. quaternions on one hemisphere, as filter() does
+			std::vector<ChannelUnit> units = channelUnits(group);
+			for (const ChannelUnit& unit : units) {
+				if (unit.kernel) unit.kernel->encode(channels.data() + unit.first, n);
+			}
+			std::vector<float> times = keys.uniform() ? std::vector<float>() : keys.copyTimes();
+			fitBSpline(channels.data(), channels.size(), n, times.empty() ? nullptr : times.data(), m, smoothing, out.data());
+			for (const ChannelUnit& unit : units) {
+				if (unit.kernel) unit.kernel->decode(out.data() + unit.first, m);
+			}
+			for (size_t c = 0; c < group.size(); c++) {
+				Event& e = *group[c];
+				e.keyframes.assign(std::move(fitted[c]));
+				e.interpolation = INTERPOLATION_BSPLINE;
+				e.playhead = 0;
+				e.edited();
+				journalKeys(e);
+			}
+		}
+	}
+
+	void Sequencer::fit(std::string label, float smoothing, int points)
+	{
+		for (Track& t : tracks) {
+			if (t.label != label) continue;
+			std::vector<Event*> events;
+			for (Event& e : t.events) events.push_back(&e);
+			fit(events, smoothing, points);
+		}
+		checkpoint();
+	}
+}
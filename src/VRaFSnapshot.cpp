@@ -0,0 +1,22 @@
+#include "VRaFSnapshot.h"
+
+namespace VRaF {
+
+	void SnapshotBuffer::publish(uint64_t version, double frame, const float* values, int count)
+	{
+		PublishedFrame& s = slots[back];
+		s.version = version;
+		s.frame = frame;
+		// Allocates only when channels were added since this slot was last used
+		s.values.assign(values, values + count);
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+	}
+
+	const PublishedFrame& SnapshotBuffer::read()
+	{
+		if (middle.load(std::memory_order_relaxed) & FRESH) {
+			front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+		}
+		return slots[front];
+	}
+}
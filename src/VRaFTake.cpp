@@ -0,0 +1,378 @@
+#include "VRaFTake.h"
+#include "VRaFSequencer.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+namespace fs = std::filesystem;
+
+static_assert(std::endian::native == std::endian::little, "Take files are little endian");
+static_assert(sizeof(VRaF::TakeHeader) == 56 && sizeof(VRaF::TakeTrack) == 32 && sizeof(VRaF::TakeEvent) == 20
+	&& sizeof(VRaF::TakeColumn) == 32, "Take file records must have no padding");
+
+namespace VRaF {
+
+	std::shared_ptr<MappedFile> MappedFile::open(const std::string& path)
+	{
+		std::shared_ptr<MappedFile> file(new MappedFile());
+#ifdef _WIN32
+		HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (handle == INVALID_HANDLE_VALUE) return nullptr;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+			CloseHandle(handle);
+			return nullptr;
+		}
+		HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+		CloseHandle(handle);
+		if (!mapping) return nullptr;
+		file->bytes = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mapping);
+		if (!file->bytes) return nullptr;
+		file->length = (size_t)size.QuadPart;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0) return nullptr;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0) {
+			close(fd);
+			return nullptr;
+		}
+		void* bytes = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (bytes == MAP_FAILED) return nullptr;
+		file->bytes = (const uint8_t*)bytes;
+		file->length = info.st_size;
+#endif
+		return file;
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (!bytes) return;
+#ifdef _WIN32
+		UnmapViewOfFile(bytes);
+#else
+		munmap((void*)bytes, length);
+#endif
+	}
+
+	void compress(const float* values, size_t count, std::vector<uint8_t>& out)
+	{
+		// Neighbouring keys of a smooth curve share the sign, the exponent and
+		// the top of the mantissa, so the high byte planes are mostly zeros
+		std::vector<uint32_t> bits(count);
+		uint32_t previous = 0;
+		for (size_t i = 0; i < count; i++) {
+			uint32_t b = std::bit_cast<uint32_t>(values[i]);
+			bits[i] = b ^ previous;
+			previous = b;
+		}
+		out.clear();
+		size_t zeros = 0;
+		auto flush = [&]() {
+			if (zeros == 0) return;
+			out.push_back(0);
+			for (; zeros >= 0x80; zeros >>= 7) out.push_back((uint8_t)(zeros | 0x80));
+			out.push_back((uint8_t)zeros);
+			zeros = 0;
+		};
+		for (int plane = 0; plane < 4; plane++) {
+			for (size_t i = 0; i < count; i++) {
+				uint8_t byte = (uint8_t)(bits[i] >> (plane * 8));
+				if (byte == 0) {
+					zeros++;
+					continue;
+				}
+				flush();
+				out.push_back(byte);
+			}
+		}
+		flush();
+	}
+
+	bool decompress(const uint8_t* data, size_t size, float* values, size_t count)
+	{
+		std::vector<uint8_t> planes(count * 4);
+		size_t at = 0;
+		for (size_t i = 0; i < size; i++) {
+			if (data[i] != 0) {
+				if (at == planes.size()) return false;
+				planes[at++] = data[i];
+				continue;
+			}
+			size_t zeros = 0;
+			for (int shift = 0; ; shift += 7) {
+				if (++i == size || shift > 56) return false;
+				zeros |= (size_t)(data[i] & 0x7F) << shift;
+				if (!(data[i] & 0x80)) break;
+			}
+			if (zeros > planes.size() - at) return false;
+			at += zeros;  // Already zeroed
+		}
+		if (at != planes.size()) return false;
+		uint32_t previous = 0;
+		for (size_t i = 0; i < count; i++) {
+			uint32_t b = 0;
+			for (int plane = 0; plane < 4; plane++) b |= (uint32_t)planes[plane * count + i] << (plane * 8);
+			previous ^= b;
+			values[i] = std::bit_cast<float>(previous);
+		}
+		return true;
+	}
+
+	bool Sequencer::save(std::string path, bool compressed) const
+	{
+		struct Block {
+			const Keyframes* keys;  // Written chunk by chunk
+			bool is_times;          // The times column of the keys, not the values
+			size_t count;
+			std::vector<uint8_t> packed;  // Empty for raw columns
+		};
+		std::vector<TakeTrack> take_tracks;
+		std::vector<TakeEvent> take_events;
+		std::vector<Block> blocks;
+		std::string labels;
+		// Time columns shared by several events are stored once
+		std::map<std::vector<const float*>, uint32_t> time_columns;
+		auto addColumn = [&](const Keyframes* keys, bool is_times, size_t count) {
+			blocks.push_back({ keys, is_times, count });
+			if (compressed) {
+				std::vector<float> values = is_times ? keys->copyTimes() : keys->copy();
+				compress(values.data(), count, blocks.back().packed);
+				if (blocks.back().packed.size() >= count * sizeof(float)) blocks.back().packed.clear();
+			}
+			return (uint32_t)(blocks.size() - 1);
+		};
+
+		for (const Track& t : tracks) {
+			TakeTrack take_track = {
+				.label_offset = (uint32_t)labels.size(),
+				.label_size = (uint32_t)t.label.size(),
+				.first_event = (uint32_t)take_events.size(),
+				.event_count = (uint32_t)t.events.size(),
+				.color = { t.color.Value.x, t.color.Value.y, t.color.Value.z, t.color.Value.w }
+			};
+			take_tracks.push_back(take_track);
+			labels += t.label;
+			for (const Event& e : t.events) {
+				const Keyframes& keys = e.keyframes;
+				TakeEvent take_event = {
+					.time = e.time,
+					.duration = e.duration,
+					.interpolation = (uint32_t)e.interpolation,
+					.values = addColumn(&keys, false, keys.size()),
+					.times = TAKE_UNIFORM
+				};
+				if (!keys.uniform()) {
+					std::vector<const float*> chunks;
+					for (size_t c = 0; c < keys.chunkCount(); c++) chunks.push_back(keys.timeChunk(c));
+					auto found = time_columns.find(chunks);
+					if (found == time_columns.end())
+						found = time_columns.emplace(chunks, addColumn(&keys, true, keys.size())).first;
+					take_event.times = found->second;
+				}
+				take_events.push_back(take_event);
+			}
+		}
+
+		TakeHeader header = {
+			.version = TAKE_VERSION,
+			.header_size = sizeof(TakeHeader),
+			.fps = fps,
+			.range = { state.range[0], state.range[1] },
+			.track_count = (uint32_t)take_tracks.size(),
+			.event_count = (uint32_t)take_events.size(),
+			.column_count = (uint32_t)blocks.size()
+		};
+		memcpy(header.magic, TAKE_MAGIC, sizeof(header.magic));
+		header.labels_offset = sizeof(TakeHeader) + take_tracks.size() * sizeof(TakeTrack)
+			+ take_events.size() * sizeof(TakeEvent) + blocks.size() * sizeof(TakeColumn);
+		header.labels_size = labels.size();
+
+		auto align = [](uint64_t offset) { return (offset + TAKE_ALIGNMENT - 1) / TAKE_ALIGNMENT * TAKE_ALIGNMENT; };
+		std::vector<TakeColumn> columns;
+		uint64_t offset = header.labels_offset + header.labels_size;
+		for (const Block& b : blocks) {
+			offset = align(offset);
+			TakeColumn column = {
+				.offset = offset,
+				.size = b.packed.empty() ? b.count * sizeof(float) : b.packed.size(),
+				.count = b.count,
+				.codec = b.packed.empty() ? CODEC_RAW : CODEC_XOR_RLE
+			};
+			columns.push_back(column);
+			offset += column.size;
+		}
+
+		// The take is written next to the destination and then renamed over it, as
+		// the destination may be mapped by a running process, even by this one
+		std::string temporary = path + ".tmp";
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		if (!file) {
+			std::cout << "Could not write " << temporary << std::endl;
+			return false;
+		}
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)take_tracks.data(), take_tracks.size() * sizeof(TakeTrack));
+		file.write((const char*)take_events.data(), take_events.size() * sizeof(TakeEvent));
+		file.write((const char*)columns.data(), columns.size() * sizeof(TakeColumn));
+		file.write(labels.data(), labels.size());
+		const char padding[TAKE_ALIGNMENT] = {};
+		offset = header.labels_offset + header.labels_size;
+		for (size_t i = 0; i < blocks.size(); i++) {
+			file.write(padding, columns[i].offset - offset);
+			const Block& b = blocks[i];
+			if (!b.packed.empty()) file.write((const char*)b.packed.data(), columns[i].size);
+			else {
+				for (size_t c = 0; c < b.keys->chunkCount(); c++) {
+					const float* chunk = b.is_times ? b.keys->timeChunk(c) : b.keys->chunk(c);
+					file.write((const char*)chunk, b.keys->chunkSize(c) * sizeof(float));
+				}
+			}
+			offset = columns[i].offset + columns[i].size;
+		}
+		file.close();
+		std::error_code error;
+		if (file) fs::rename(temporary, path, error);
+		if (!file || error) {
+			std::cout << "Could not write " << path << std::endl;
+			fs::remove(temporary, error);
+			return false;
+		}
+		return true;
+	}
+
+	bool Sequencer::load(std::string path)
+	{
+		std::shared_ptr<MappedFile> file = MappedFile::open(path);
+		if (!file) {
+			std::cout << "Could not open " << path << std::endl;
+			return false;
+		}
+		auto fail = [&](const char* reason) {
+			std::cout << path << ": " << reason << std::endl;
+			return false;
+		};
+		const uint8_t* bytes = file->data();
+		size_t size = file->size();
+
+		TakeHeader header = {};
+		if (size < sizeof(TakeHeader)) return fail("not a take file");
+		memcpy(&header, bytes, sizeof(TakeHeader));
+		if (memcmp(header.magic, TAKE_MAGIC, sizeof(header.magic)) != 0) return fail("not a take file");
+		if (header.version > TAKE_VERSION) return fail("take file from a newer version");
+		if (header.header_size < sizeof(TakeHeader) || header.header_size > size) return fail("corrupt header");
+
+		// Tables are small and not necessarily aligned, so they're copied out
+		uint64_t tables = (uint64_t)header.track_count * sizeof(TakeTrack)
+			+ (uint64_t)header.event_count * sizeof(TakeEvent) + (uint64_t)header.column_count * sizeof(TakeColumn);
+		if (tables > size - header.header_size) return fail("truncated");
+		std::vector<TakeTrack> take_tracks(header.track_count);
+		std::vector<TakeEvent> take_events(header.event_count);
+		std::vector<TakeColumn> columns(header.column_count);
+		const uint8_t* at = bytes + header.header_size;
+		memcpy(take_tracks.data(), at, take_tracks.size() * sizeof(TakeTrack));
+		at += take_tracks.size() * sizeof(TakeTrack);
+		memcpy(take_events.data(), at, take_events.size() * sizeof(TakeEvent));
+		at += take_events.size() * sizeof(TakeEvent);
+		memcpy(columns.data(), at, columns.size() * sizeof(TakeColumn));
+		if (header.labels_offset > size || header.labels_size > size - header.labels_offset) return fail("truncated");
+		for (const TakeColumn& c : columns) {
+			if (c.offset > size || c.size > size - c.offset || c.count > SIZE_MAX / sizeof(float)) return fail("truncated");
+			if (c.codec == CODEC_RAW && (c.offset % alignof(float) != 0 || c.size != c.count * sizeof(float))) return fail("corrupt column");
+			if (c.codec > CODEC_XOR_RLE) return fail("unknown column codec");
+		}
+
+		// Raw columns alias the mapping, which stays open while any of them is in use
+		std::vector<std::shared_ptr<const float>> decoded(columns.size());
+		auto column = [&](uint32_t i) -> std::shared_ptr<const float> {
+			if (decoded[i]) return decoded[i];
+			const TakeColumn& c = columns[i];
+			if (c.codec == CODEC_RAW) {
+				decoded[i] = std::shared_ptr<const float>(file, (const float*)(bytes + c.offset));
+			}
+			else {
+				std::vector<float> values(c.count);
+				if (decompress(bytes + c.offset, c.size, values.data(), c.count)) decoded[i] = Keyframes::column(std::move(values));
+			}
+			return decoded[i];
+		};
+
+		// Everything is checked before any track is touched
+		struct Match {
+			Track* track;
+			const TakeTrack* take;
+			std::vector<std::shared_ptr<const float>> values, times;
+		};
+		std::vector<Match> matches;
+		for (const TakeTrack& take_track : take_tracks) {
+			if (take_track.label_offset > header.labels_size || take_track.label_size > header.labels_size - take_track.label_offset) return fail("corrupt label");
+			if (take_track.first_event > take_events.size() || take_track.event_count > take_events.size() - take_track.first_event) return fail("corrupt track");
+			std::string label((const char*)bytes + header.labels_offset + take_track.label_offset, take_track.label_size);
+			// The targets belong to the application, so only tracks it has set up are loaded
+			auto t = std::find_if(tracks.begin(), tracks.end(), [&](const Track& other) { return other.label == label; });
+			if (t == tracks.end()) {
+				std::cout << path << ": skipping track " << label << " which isn't tracked" << std::endl;
+				continue;
+			}
+			if (t->events.size() != take_track.event_count) {
+				std::cout << path << ": skipping track " << label << " with a different number of components" << std::endl;
+				continue;
+			}
+			Match match = { &*t, &take_track };
+			for (size_t i = 0; i < t->events.size(); i++) {
+				const TakeEvent& take_event = take_events[take_track.first_event + i];
+				if (take_event.values >= columns.size()) return fail("corrupt event");
+				if (take_event.times != TAKE_UNIFORM && (take_event.times >= columns.size() || columns[take_event.times].count != columns[take_event.values].count)) return fail("corrupt event");
+				std::shared_ptr<const float> values = column(take_event.values);
+				std::shared_ptr<const float> times = take_event.times == TAKE_UNIFORM ? nullptr : column(take_event.times);
+				if (!values || (take_event.times != TAKE_UNIFORM && !times)) return fail("corrupt column");
+				match.values.push_back(values);
+				match.times.push_back(times);
+			}
+			matches.push_back(std::move(match));
+		}
+
+		for (Match& match : matches) {
+			Track& t = *match.track;
+			const float* color = match.take->color;
+			t.recordings.clear();
+			t.color = ImColor(color[0], color[1], color[2], color[3]);
+			for (size_t i = 0; i < t.events.size(); i++) {
+				const TakeEvent& take_event = take_events[match.take->first_event + i];
+				Event& e = t.events[i];
+				e.keyframes.view(match.values[i], columns[take_event.values].count, match.times[i]);
+				e.time = take_event.time;
+				e.duration = take_event.duration;
+				e.interpolation = (Interpolation)std::min(take_event.interpolation, (uint32_t)INTERPOLATION_BSPLINE);
+				e.playhead = 0;
+				e.edited();
+				journalKeys(e);
+			}
+		}
+		fps = header.fps > 0 ? header.fps : fps;
+		state.range[0] = header.range[0];
+		state.range[1] = header.range[1];
+		if (state.frame < state.range[0]) state.frame = state.range[0];
+		if (state.frame > state.range[1]) state.frame = state.range[1];
+		index.dirty = true;
+		updateRecordingTracks();
+		checkpoint();
+		return true;
+	}
+}